@@ -0,0 +1,36 @@
+#!/bin/sh
+# SPDX-License-Identifier: GPL-3.0-or-later
+# Compares the batched evdev reader with the libevdev one on a touch storm
+# from pinenote-virtual-input: cpu time per frame, events per read and, if
+# strace is installed, syscalls per frame. Needs root for uinput and uhid.
+#
+#   RATE=<frames/s> FINGERS=<n> SECS=<s> bench/evdev-read.sh
+set -e
+
+bin=$(dirname "$0")/..
+rate=${RATE:-2000}
+fingers=${FINGERS:-10}
+secs=${SECS:-10}
+out=$(mktemp -d)
+
+"$bin/pinenote-virtual-input" --touch-rate "$rate" --fingers "$fingers" \
+  >/dev/null &
+gen=$!
+trap 'kill $gen; rm -rf "$out"' EXIT
+sleep 1
+
+for reader in batch libevdev; do
+  echo "== $reader"
+  timeout -s INT "$secs" "$bin/pinenote-usb-tablet" --use-touchscreen \
+    --output uhid --evdev-reader $reader --stats 2>"$out/$reader.stats" || :
+  grep -E '^cyttsp5|^cpu time' "$out/$reader.stats"
+
+  command -v strace >/dev/null || continue
+  strace -f -c -o "$out/$reader.strace" timeout -s INT "$secs" \
+    "$bin/pinenote-usb-tablet" --use-touchscreen --output uhid \
+    --evdev-reader $reader --stats 2>"$out/$reader.traced" || :
+  frames=$(awk '$1 == "cyttsp5" { print $3 }' "$out/$reader.traced")
+  calls=$(awk '$NF == "total" { print $4 }' "$out/$reader.strace")
+  echo "syscalls: $calls for $frames frames" \
+    "($(echo "scale=2; $calls / $frames" | bc) per frame)"
+done
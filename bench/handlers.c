@@ -0,0 +1,247 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+// Time and heap allocations per input event of the report handlers in
+// libpinenote.a, over synthetic event sequences shaped like real input,
+// writing to an output that only counts. Linked with --wrap for the
+// allocator, so any allocation on the hot path shows up.
+#include "../handlers.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define MAX_EVENTS 65536
+#define ROUNDS 200
+
+static uint64_t allocations;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t n, size_t size);
+void *__real_realloc(void *p, size_t size);
+void __real_free(void *p);
+
+void *__wrap_malloc(size_t size) {
+  allocations++;
+  return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t n, size_t size) {
+  allocations++;
+  return __real_calloc(n, size);
+}
+
+void *__wrap_realloc(void *p, size_t size) {
+  allocations++;
+  return __real_realloc(p, size);
+}
+
+void __wrap_free(void *p) { __real_free(p); }
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint64_t written_bytes;
+
+static ssize_t sink_write(output *out, const void *buf, size_t len) {
+  written_bytes += len;
+  return len;
+}
+
+static output sink = {.name = "sink", .fd = -1, .write = sink_write};
+
+typedef struct {
+  struct input_event ev[MAX_EVENTS];
+  int n;
+  uint64_t t_ns;
+} sequence;
+
+static sequence seq;
+
+static void add(uint16_t type, uint16_t code, int32_t value) {
+  struct input_event *ev = &seq.ev[seq.n++];
+
+  ev->type = type;
+  ev->code = code;
+  ev->value = value;
+  ev->time.tv_sec = seq.t_ns / 1000000000;
+  ev->time.tv_usec = seq.t_ns / 1000 % 1000000;
+}
+
+static void syn(uint64_t period_ns) {
+  add(EV_SYN, SYN_REPORT, 0);
+  seq.t_ns += period_ns;
+}
+
+// one finger down, dragged across the screen at the panel's ~100 Hz, lifted
+static void make_drag(void) {
+  seq.n = 0;
+  add(EV_ABS, ABS_MT_SLOT, 0);
+  add(EV_ABS, ABS_MT_TRACKING_ID, 1);
+  for (int f = 0; f < 2000; f++) {
+    add(EV_ABS, ABS_MT_POSITION_X, 100 + f / 2);
+    add(EV_ABS, ABS_MT_POSITION_Y, 200 + f);
+    syn(10000000);
+  }
+  add(EV_ABS, ABS_MT_TRACKING_ID, -1);
+  syn(10000000);
+}
+
+// ten fingers moving every frame, each lifting and landing again in turn
+static void make_storm(void) {
+  seq.n = 0;
+  for (int f = 0; f < 1000; f++) {
+    for (int i = 0; i < 10; i++) {
+      add(EV_ABS, ABS_MT_SLOT, i);
+      if (f == 0 || f % 50 == 5 * i + 1)
+        add(EV_ABS, ABS_MT_TRACKING_ID, f * 10 + i);
+      else if (f % 50 == 5 * i)
+        add(EV_ABS, ABS_MT_TRACKING_ID, -1);
+      add(EV_ABS, ABS_MT_POSITION_X, 100 * i + f % 100);
+      add(EV_ABS, ABS_MT_POSITION_Y, 1000 + f);
+    }
+    syn(10000000);
+  }
+  for (int i = 0; i < 10; i++) {
+    add(EV_ABS, ABS_MT_SLOT, i);
+    add(EV_ABS, ABS_MT_TRACKING_ID, -1);
+  }
+  syn(10000000);
+}
+
+// the ws8100 reports a double press as KEY_MACRO1/2/3 nested in (or for
+// button 3, instead of) the single press
+static void make_buttons(void) {
+  static const uint16_t tools[] = {BTN_TOOL_RUBBER, BTN_TOOL_PEN};
+  static const uint16_t macros[] = {KEY_MACRO1, KEY_MACRO2};
+
+  seq.n = 0;
+  for (int r = 0; r < 1000; r++) {
+    for (int b = 0; b < 2; b++) {
+      add(EV_KEY, tools[b], 1);
+      syn(50000000);
+      add(EV_KEY, macros[b], 1);
+      syn(1000000);
+      add(EV_KEY, macros[b], 0);
+      syn(50000000);
+      add(EV_KEY, tools[b], 0);
+      syn(200000000);
+    }
+    add(EV_KEY, KEY_MACRO3, 1);
+    syn(1000000);
+    add(EV_KEY, KEY_MACRO3, 0);
+    syn(200000000);
+  }
+}
+
+typedef int (*handler_fn)(struct input_event ev, void *data, output *out);
+
+static void reset_touches(slots *touches) {
+  memset(touches, 0, sizeof(*touches));
+  for (int i = 0; i < MAX_SLOTS; i++)
+    touches->tid[i] = -1;
+  touches->host_down = ALL_SLOTS;
+  touches->contacts_per_report = MAX_SLOTS;
+}
+
+static void report(const char *name, uint64_t events, uint64_t ns,
+                   uint64_t reports, uint64_t allocs) {
+  printf("%-24s %10.1f %14.2f %14.3f\n", name, (double)ns / events,
+         (double)reports / events, (double)allocs / events);
+}
+
+static void bench_events(const char *name, handler_fn handler, void *data) {
+  uint64_t reports = 0, allocs = allocations, start = now_ns();
+
+  for (int r = 0; r < ROUNDS; r++) {
+    for (int i = 0; i < seq.n; i++) {
+      int n = handler(seq.ev[i], data, &sink);
+
+      if (n < 0)
+        exit(1);
+      reports += n;
+    }
+  }
+  report(name, (uint64_t)ROUNDS * seq.n, now_ns() - start, reports,
+         allocations - allocs);
+}
+
+// the pen hovering at the w9013's full rate, one report per event, tilted
+// a little further every report unless steady
+static void bench_pen(const char *name, pen_path *pen, bool steady) {
+  static unsigned char reports[4096][W9013_REPORT_LEN];
+  uint64_t n = 0, t_ns = 0, allocs, start;
+
+  for (int i = 0; i < 4096; i++) {
+    uint16_t x = 5000 + i * 3, y = 8000 + i * 2, pressure = 0;
+    int16_t tx = steady ? 1000 : 1000 - i % 200;
+    int16_t ty = steady ? -500 : -500 + i % 100;
+
+    reports[i][0] = PEN_REPORT_ID;
+    reports[i][1] = PEN_IN_RANGE;
+    memcpy(&reports[i][PEN_X], &x, 2);
+    memcpy(&reports[i][PEN_Y], &y, 2);
+    memcpy(&reports[i][PEN_PRESSURE], &pressure, 2);
+    memcpy(&reports[i][PEN_X_TILT], &tx, 2);
+    memcpy(&reports[i][PEN_Y_TILT], &ty, 2);
+  }
+  allocs = allocations;
+  start = now_ns();
+  for (int r = 0; r < ROUNDS; r++) {
+    for (int i = 0; i < 4096; i++) {
+      int w = pen_path_forward(pen, &sink, reports[i], W9013_REPORT_LEN,
+                               t_ns += 1000000000 / 360);
+
+      if (w < 0)
+        exit(1);
+      n += w;
+    }
+  }
+  report(name, (uint64_t)ROUNDS * 4096, now_ns() - start, n,
+         allocations - allocs);
+}
+
+int main(void) {
+  static slots touches;
+  static pen_path pen = {.timer_fd = -1};
+  static pen_buttons buttons = {.report = {1, 0}};
+
+  printf("%-24s %10s %14s %14s\n", "sequence", "ns/event", "reports/event",
+         "allocs/event");
+
+  make_drag();
+  reset_touches(&touches);
+  bench_events("single-finger drag", handle_cyttsp_events, &touches);
+  reset_touches(&touches);
+  touches.keepalive_ns = 50000000;
+  bench_events("drag, keepalive", handle_cyttsp_events, &touches);
+
+  make_storm();
+  reset_touches(&touches);
+  bench_events("ten-finger storm", handle_cyttsp_events, &touches);
+  reset_touches(&touches);
+  touches.keepalive_ns = 50000000;
+  bench_events("storm, keepalive", handle_cyttsp_events, &touches);
+
+  make_buttons();
+  bench_events("button double presses", handle_ws8100_pen_events, &buttons);
+
+  pen_transform_defaults(&pen.transform);
+  pen_transform_init(&pen.transform);
+  bench_pen("pen hover", &pen, false);
+  pen_filter_parse(&pen.filter, "1,0.007,4");
+  pen_transform_parse_rotation(&pen.transform, "90");
+  pen_transform_parse_pressure(&pen.transform, "1.5");
+  pen_transform_init(&pen.transform);
+  bench_pen("hover, filter+transform", &pen, false);
+  // ticks are not run here, this is the cost of buffering a report
+  pen_resample_parse(&pen.resample, "240");
+  bench_pen("hover, resample push", &pen, false);
+  // a tilt change always goes out, the steady pen shows what is dropped
+  pen.resample.enabled = false;
+  pen_throttle_parse(&pen.throttle, "60,4");
+  bench_pen("hover, throttle 60 Hz", &pen, true);
+  return 0;
+}
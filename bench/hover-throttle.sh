@@ -0,0 +1,23 @@
+#!/bin/sh
+# SPDX-License-Identifier: GPL-3.0-or-later
+# Replays a pen trace through --hover-throttle with each of SETTINGS and
+# prints how many reports went out, in all and while hovering, next to the
+# unthrottled run. Needs no hardware, reports go to files.
+#
+#   TRACE=<file> SETTINGS="<hz>[,<dead-band>] ..." bench/hover-throttle.sh
+set -e
+
+bin=$(dirname "$0")/..
+trace=${TRACE:?set TRACE to a trace recorded with --record}
+settings=${SETTINGS:-0 120 60 60,4 30,8}
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+
+echo "== unthrottled"
+"$bin/pinenote-usb-tablet" --replay "$trace" --output "file:$tmp/r" \
+  --stats 2>&1 | grep -E '^w9013 ' || :
+for s in $settings; do
+  echo "== $s"
+  "$bin/pinenote-usb-tablet" --replay "$trace" --output "file:$tmp/r" \
+    --hover-throttle "$s" --stats 2>&1 | grep -E '^(w9013 |pen throttle)' || :
+done
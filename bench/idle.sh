@@ -0,0 +1,22 @@
+#!/bin/sh
+# SPDX-License-Identifier: GPL-3.0-or-later
+# Wakeups and syscalls per second of each source while nothing is being
+# used: the pen out of range, no finger down, the virtual devices silent.
+# Anything above zero is a wakeup that costs battery for nothing. Needs
+# root for uinput and uhid.
+#
+#   SECS=<s> bench/idle.sh
+set -e
+
+bin=$(dirname "$0")/..
+secs=${SECS:-30}
+out=$(mktemp -d)
+
+"$bin/pinenote-virtual-input" >/dev/null &
+gen=$!
+trap 'kill $gen; rm -rf "$out"' EXIT
+sleep 1
+
+timeout -s INT "$secs" "$bin/pinenote-usb-tablet" --use-touchscreen \
+  --output uhid --stats 2>"$out/stats" || :
+sed -n '/^source /,/^context switches/p' "$out/stats"
@@ -0,0 +1,59 @@
+#!/bin/sh
+# SPDX-License-Identifier: GPL-3.0-or-later
+# The epoll loop against --io-engine uring, on the same forwarded load:
+# pinenote-virtual-input drives the pen at each of RATES with a touch storm
+# at TOUCH_RATE, and the forwarder's --stats give, per report forwarded,
+#
+#   syscalls   everything the loop and the sources made: waits, reads,
+#              writes, io_uring_enter()
+#   us         cpu time
+#   wakeups    returns from the wait
+#   csw, icsw  voluntary and involuntary context switches of the forwarder,
+#              for the whole run; work io_uring hands to kernel threads
+#              would show up as voluntary ones while the loop waits
+#
+# Needs root, uinput and uhid, and a kernel with io_uring (5.13 or later),
+# or the uring lines show epoll again.
+#
+#   RATES="<hz> ..." TOUCH_RATE=<hz> SECS=<s> OUTPUT=<backend> \
+#     bench/io-engine.sh
+set -e
+
+bin=$(dirname "$0")/..
+rates=${RATES:-500 2000 10000}
+touch_rate=${TOUCH_RATE:-240}
+secs=${SECS:-5}
+output=${OUTPUT:-uhid}
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+
+printf '%8s %8s %10s %10s %10s %10s %10s\n' rate engine syscalls us wakeups \
+  csw icsw
+for rate in $rates; do
+  for engine in epoll uring; do
+    "$bin/pinenote-virtual-input" --pen-rate "$rate" \
+      --touch-rate "$touch_rate" --storm --delay 1 --duration "$secs" \
+      >/dev/null 2>&1 &
+    gen=$!
+    sleep 0.5
+    "$bin/pinenote-usb-tablet" --use-touchscreen --output "$output" \
+      --io-engine "$engine" --stats 2>"$tmp/fwd" &
+    fwd=$!
+    sleep $((secs + 2))
+    kill -INT $fwd
+    wait $fwd || :
+    kill -INT $gen
+    wait $gen || :
+    awk -v rate="$rate" -v engine="$engine" '
+      /using epoll$/ { engine = "epoll" }
+      ($1 == "w9013" || $1 == "cyttsp5") && NF == 6 { reports += $3 }
+      /^syscalls:/ { split($3, a, "/"); syscalls = a[1] }
+      /^loop wakeups:/ { wakeups = $3 }
+      /^cpu time:/ { us = $(NF - 1) }
+      /^context switches:/ { csw = $3; icsw = $5 }
+      END {
+        printf "%8d %8s %10.3f %10.3f %10.3f %10d %10d\n", rate, engine,
+               syscalls, us, reports ? wakeups / reports : 0, csw, icsw
+      }' "$tmp/fwd"
+  done
+done
@@ -0,0 +1,25 @@
+#!/bin/sh
+# SPDX-License-Identifier: GPL-3.0-or-later
+# Button reports of their own against --merge-buttons over a replayed
+# trace with pen buttons pressed while writing, and how long a merged
+# change waits for the pen report that carries it. Needs no hardware,
+# reports go to files.
+#
+#   TRACE=<file> bench/merge-buttons.sh
+set -e
+
+bin=$(dirname "$0")/..
+trace=${TRACE:?set TRACE to a trace recorded with --record}
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+
+for mode in separate merged; do
+  opts=
+  [ $mode = merged ] && opts=--merge-buttons
+  "$bin/pinenote-usb-tablet" --replay "$trace" --output "file:$tmp/r" \
+    --stats $opts 2>"$tmp/stats"
+  awk -v mode=$mode '
+    $1 == "ws8100_pen" && NF == 6 { printf "%-9s %d Report ID 1\n", mode, $3 }
+    /^buttons:/ || /^button to pen report:/ { print "          " $0 }
+  ' "$tmp/stats"
+done
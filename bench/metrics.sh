@@ -0,0 +1,88 @@
+#!/bin/sh
+# SPDX-License-Identifier: GPL-3.0-or-later
+# Scrapes --metrics while pinenote-virtual-input drives the pen at RATE and
+# the touchscreen at TOUCH_RATE, checks every scrape parses as Prometheus
+# text with counters that never go backwards and that reports were
+# counted, and compares the forwarder's cpu time with and without scrapes.
+# Fails on a scrape that cannot be fetched or does not parse. Needs root,
+# uinput and uhid; curl does the scraping.
+#
+#   RATE=<hz> TOUCH_RATE=<hz> SECS=<s> INTERVAL=<s> OUTPUT=<backend> \
+#     bench/metrics.sh
+set -e
+
+bin=$(dirname "$0")/..
+rate=${RATE:-500}
+touch_rate=${TOUCH_RATE:-120}
+secs=${SECS:-5}
+interval=${INTERVAL:-0.1}
+output=${OUTPUT:-uhid}
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+
+# starts the load and the forwarder, the caller stops them with stop
+start() {
+  "$bin/pinenote-virtual-input" --pen-rate "$rate" --touch-rate "$touch_rate" \
+    --delay 1 --duration "$((secs + 1))" >/dev/null 2>&1 &
+  gen=$!
+  sleep 0.5
+  "$bin/pinenote-usb-tablet" --use-touchscreen --output "$output" --stats \
+    "$@" 2>"$tmp/stats" &
+  fwd=$!
+  sleep 1
+}
+
+stop() {
+  kill -INT $fwd
+  wait $fwd || :
+  kill -INT $gen
+  wait $gen || :
+}
+
+start
+sleep "$secs"
+stop
+base=$(awk '/^cpu time:/ { print $3 }' "$tmp/stats")
+
+start --metrics "$tmp/sock"
+scrapes=0
+failed=0
+end=$(($(date +%s) + secs))
+while [ "$(date +%s)" -lt $end ]; do
+  if ! curl -sf --unix-socket "$tmp/sock" http://localhost/metrics \
+    >"$tmp/scrape"; then
+    echo "scrape $((scrapes + 1)) failed" >&2
+    failed=1
+    break
+  fi
+  scrapes=$((scrapes + 1))
+  cat "$tmp/scrape" >>"$tmp/all"
+  sleep "$interval"
+done
+stop
+scraped=$(awk '/^cpu time:/ { print $3 }' "$tmp/stats")
+[ $failed = 0 ] && [ $scrapes -gt 0 ] || exit 1
+
+# every sample line is "name{label="..."} value", the same series never
+# decreases from one scrape to the next, and the pen reports were counted
+awk '
+  /^#/ { next }
+  NF != 2 || $1 !~ /^pinenote_[a-z_]+\{[a-z]+="[a-z0-9_]+"\}$/ ||
+    $2 !~ /^[0-9]+$/ { print "malformed: " $0; bad++; next }
+  ($1 in last) && $2 < last[$1] { print "went backwards: " $0; bad++ }
+  { last[$1] = $2 }
+  END {
+    for (k in last) {
+      if (k ~ /reports_total/)
+        printf "%s %d\n", k, last[k]
+      if (k ~ /reports_total/ && k ~ /w9013/ && last[k] > 0)
+        pen = 1
+    }
+    if (!pen) {
+      print "no pen reports counted"
+      bad++
+    }
+    exit bad != 0
+  }' "$tmp/all"
+echo "$scrapes scrapes, cpu time $base us without," \
+  "$scraped us with (serving thread included)"
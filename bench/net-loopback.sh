@@ -0,0 +1,38 @@
+#!/bin/sh
+# SPDX-License-Identifier: GPL-3.0-or-later
+# Replays a trace through --output udp: and tcp: into pinenote-net-receiver
+# on the same machine, once as fast as possible for throughput and once in
+# real time for the send-to-write latency, and the jitter between the
+# reports' Scan Time and their arrival (only meaningful in real time, fast
+# replays keep the recorded times). Needs no hardware, the receiver writes
+# report files.
+#
+#   TRACE=<file> PORT=<port> bench/net-loopback.sh
+set -e
+
+bin=$(dirname "$0")/..
+trace=${TRACE:?set TRACE to a trace recorded with --record}
+port=${PORT:-7531}
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+
+for proto in udp tcp; do
+  for pace in fast realtime; do
+    opts=
+    [ $proto = tcp ] && opts=--tcp
+    "$bin/pinenote-net-receiver" $opts --port "$port" \
+      --output "file:$tmp/r" --stats 2>"$tmp/stats" &
+    rx=$!
+    sleep 0.5
+    opts=
+    [ $pace = realtime ] && opts=--realtime
+    echo "== $proto $pace"
+    "$bin/pinenote-usb-tablet" --replay "$trace" $opts --use-touchscreen \
+      --output "$proto:127.0.0.1:$port" --stats 2>&1 |
+      grep -E '^(net|replay)' || :
+    sleep 0.5
+    kill -INT $rx
+    wait $rx || :
+    cat "$tmp/stats"
+  done
+done
@@ -0,0 +1,33 @@
+#!/bin/sh
+# SPDX-License-Identifier: GPL-3.0-or-later
+# Touch frames suppressed, contacts and reports sent without
+# --palm-rejection and with each of HOLDOFFS, over a replayed trace with
+# the pen and the touchscreen recorded together. Needs no hardware,
+# reports go to files.
+#
+#   TRACE=<file> HOLDOFFS="<ms> ..." bench/palm-rejection.sh
+set -e
+
+bin=$(dirname "$0")/..
+trace=${TRACE:?set TRACE to a trace recorded with --record --use-touchscreen}
+holdoffs=${HOLDOFFS:-0 100 300}
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+
+printf '%-10s %10s %10s %10s %12s %12s\n' hold-off frames suppressed \
+  contacts touch-reps pen-reps
+for h in off $holdoffs; do
+  opts=
+  [ $h != off ] && opts="--palm-rejection $h"
+  "$bin/pinenote-usb-tablet" --replay "$trace" --use-touchscreen \
+    --output "file:$tmp/r" --stats $opts 2>"$tmp/stats"
+  awk -v h=$h '
+    $1 == "w9013" && NF == 6 { pen = $3 }
+    $1 == "cyttsp5" && NF == 6 { touch = $3 }
+    /^palm rejection:/ { suppressed = $3 }
+    /^touch:/ { frames = $2; contacts = $4 }
+    END {
+      printf "%-10s %10d %10d %10d %12d %12d\n", h, frames, suppressed,
+             contacts, touch, pen
+    }' "$tmp/stats"
+done
@@ -0,0 +1,60 @@
+#!/bin/sh
+# SPDX-License-Identifier: GPL-3.0-or-later
+# Replays a pen trace without --pen-filter and with each of SETTINGS and
+# prints, per run, the cpu time per report, the filter's mean lag behind
+# the raw samples and the jitter of the reports that went out: the mean
+# second difference of X and Y between consecutive in-range reports, the
+# same measure the filter's own stats use. Needs no hardware, reports go
+# to files.
+#
+#   TRACE=<file> SETTINGS="<min cutoff hz>,<beta>[,<prediction ms>] ..." \
+#     bench/pen-filter.sh
+set -e
+
+bin=$(dirname "$0")/..
+trace=${TRACE:?set TRACE to a trace recorded with --record}
+settings=${SETTINGS:-1,0.007 1,0.007,4 0.5,0.01}
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+
+printf '%-16s %10s %8s %10s\n' filter us/report lag-ms jitter
+for s in off $settings; do
+  opts=
+  [ "$s" != off ] && opts="--pen-filter $s"
+  rm -f "$tmp"/r*
+  "$bin/pinenote-usb-tablet" --replay "$trace" --output "file:$tmp/r" \
+    --stats $opts 2>"$tmp/stats"
+  # Report ID 2 is 17 bytes: id, flags (0x20 in range), X and Y little
+  # endian
+  od -An -v -tu1 -w17 "$tmp/r0" |
+    awk -v s="$s" -v stats="$tmp/stats" '
+      BEGIN {
+        lag = 0
+        while ((getline line < stats) > 0) {
+          n = split(line, f, " ")
+          if (f[1] == "cpu" && f[2] == "time:")
+            us = f[6]
+          if (f[1] == "pen" && f[2] == "filter:")
+            lag = f[7]
+        }
+      }
+      $1 != 2 || NF != 17 { next }
+      int($2 / 32) % 2 == 0 { h = 0; next }
+      {
+        x = $3 + 256 * $4
+        y = $5 + 256 * $6
+        if (h == 2) {
+          dx = x - 2 * x1 + x2
+          dy = y - 2 * y1 + y2
+          sum += (dx < 0 ? -dx : dx) + (dy < 0 ? -dy : dy)
+          n2++
+        } else {
+          h++
+        }
+        x2 = x1; y2 = y1; x1 = x; y1 = y
+      }
+      END {
+        printf "%-16s %10.3f %8.2f %10.2f\n", s, us, lag,
+               n2 ? sum / n2 : 0
+      }'
+done
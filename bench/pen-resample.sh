@@ -0,0 +1,22 @@
+#!/bin/sh
+# SPDX-License-Identifier: GPL-3.0-or-later
+# Replays a pen trace in real time through --pen-resample at each of RATES
+# and prints how the ticks were filled and how late they were serviced.
+# Needs no hardware, reports go to files; add --rt to OPTS to see what the
+# scheduler costs.
+#
+#   TRACE=<file> RATES="<hz> ..." OPTS=<options> bench/pen-resample.sh
+set -e
+
+bin=$(dirname "$0")/..
+trace=${TRACE:?set TRACE to a trace recorded with --record}
+rates=${RATES:-120 240 480}
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+
+for rate in $rates; do
+  echo "== $rate Hz"
+  "$bin/pinenote-usb-tablet" --replay "$trace" --realtime \
+    --output "file:$tmp/r" --pen-resample "$rate" --stats $OPTS 2>&1 |
+    grep -E '^(w9013 |pen resample|lateness)' || :
+done
@@ -0,0 +1,31 @@
+#!/bin/sh
+# SPDX-License-Identifier: GPL-3.0-or-later
+# Pen and touch latency with --rt off and on while every cpu runs a busy
+# loop. Needs a LATENCY=1 build, root, uinput and uhid; the histograms are
+# printed when the forwarder exits.
+#
+#   SECS=<s> PRIORITY=<1-99> CPU=<n> bench/rt-stress.sh
+set -e
+
+bin=$(dirname "$0")/..
+secs=${SECS:-20}
+priority=${PRIORITY:-50}
+cpu=${CPU:-0}
+
+"$bin/pinenote-virtual-input" --pen-rate 300 --touch-rate 120 --fingers 2 \
+  >/dev/null &
+pids=$!
+for i in $(seq "$(nproc)"); do
+  sh -c 'while :; do :; done' &
+  pids="$pids $!"
+done
+trap 'kill $pids' EXIT
+sleep 1
+
+for mode in off on; do
+  opts=
+  [ $mode = on ] && opts="--rt $priority --cpu $cpu"
+  echo "== rt $mode"
+  timeout -s INT "$secs" "$bin/pinenote-usb-tablet" --use-touchscreen \
+    --output uhid $opts 2>&1 | grep -E '^(source|pen|touch) ' || :
+done
@@ -0,0 +1,41 @@
+#!/bin/sh
+# SPDX-License-Identifier: GPL-3.0-or-later
+# Time from main() to the devices being open ("Ready") and to the first
+# forwarded report, over repeated starts against pinenote-virtual-input,
+# which is started just after the forwarder, so "Ready" includes waiting
+# for its devices to appear with --wait-devices. Dynamic loading before
+# main() is not included. Needs root for uinput and uhid.
+#
+#   RUNS=<n> OUTPUT=<uhid|gadget> bench/startup.sh
+set -e
+
+bin=$(dirname "$0")/..
+runs=${RUNS:-10}
+output=${OUTPUT:-uhid}
+tmp=$(mktemp -d)
+gen=
+trap '[ -n "$gen" ] && kill $gen 2>/dev/null; rm -rf "$tmp"' EXIT
+
+printf '%4s %10s %10s %10s %12s\n' run ready_ms outputs_ms devices_ms \
+  first_ms
+for run in $(seq "$runs"); do
+  "$bin/pinenote-usb-tablet" --output "$output" --wait-devices 5 \
+    >/dev/null 2>"$tmp/log" &
+  tablet=$!
+  "$bin/pinenote-virtual-input" --storm --delay 0.2 --duration 1 \
+    >/dev/null 2>&1 &
+  gen=$!
+  sleep 2
+  kill -INT $tablet $gen 2>/dev/null || :
+  wait $tablet $gen 2>/dev/null || :
+  gen=
+  awk -v run=$run '
+    /^Ready after/ {
+      ready = $3; outputs = $6; devices = $9
+    }
+    /^First report forwarded/ { first = $4 }
+    END {
+      printf "%4d %10.1f %10.1f %10.1f %12.1f\n", run, ready, outputs,
+             devices, first
+    }' "$tmp/log"
+done
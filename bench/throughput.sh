@@ -0,0 +1,56 @@
+#!/bin/sh
+# SPDX-License-Identifier: GPL-3.0-or-later
+# Offered against forwarded load: pinenote-virtual-input drives the pen at
+# each of RATES and a touch storm over every slot at TOUCH_RATE, and the
+# forwarder's --stats are compared with what was sent. Needs root, uinput
+# and uhid. One line per rate:
+#
+#   pen/s, touch/s   reports and frames forwarded per second
+#   us/report        forwarder cpu time per report read
+#   lost             sent but never read, or read and dropped from a full
+#                    output queue
+#   resyncs          kernel evdev buffer overruns (SYN_DROPPED)
+#   coalesced        superseded in the output queue, gadget output only
+#
+#   RATES="<hz> ..." TOUCH_RATE=<hz> SECS=<s> OUTPUT=<backend> \
+#     bench/throughput.sh
+set -e
+
+bin=$(dirname "$0")/..
+rates=${RATES:-200 500 1000 2000 5000 10000}
+touch_rate=${TOUCH_RATE:-240}
+secs=${SECS:-5}
+output=${OUTPUT:-uhid}
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+
+printf '%8s %10s %10s %10s %8s %8s %10s\n' rate pen/s touch/s us/report \
+  lost resyncs coalesced
+for rate in $rates; do
+  # the generator waits for the forwarder to open the devices and keeps
+  # them until it has drained them, so every report sent is accounted for
+  "$bin/pinenote-virtual-input" --pen-rate "$rate" --touch-rate "$touch_rate" \
+    --storm --delay 1 --duration "$secs" --stats >/dev/null 2>"$tmp/sent" &
+  gen=$!
+  sleep 0.5
+  "$bin/pinenote-usb-tablet" --use-touchscreen --output "$output" \
+    --nonblock-output --stats 2>"$tmp/fwd" &
+  fwd=$!
+  sleep $((secs + 2))
+  kill -INT $fwd
+  wait $fwd || :
+  kill -INT $gen
+  wait $gen || :
+  awk -v secs="$secs" -v rate="$rate" '
+    /^sent / { pen_sent = $2; touch_sent = $6 }
+    $1 == "w9013" && NF == 6 { pen = $3 }
+    $1 == "cyttsp5" && NF == 6 { touch = $3 }
+    / resyncs$/ { resyncs += $(NF - 1) }
+    /^cpu time:/ { us = $(NF - 1) }
+    / output: .* coalesced/ { coalesced += $5; dropped += $7 }
+    END {
+      printf "%8d %10.0f %10.0f %10.3f %8d %8d %10d\n", rate, pen / secs,
+             touch / secs, us, pen_sent + touch_sent - pen - touch + dropped,
+             resyncs, coalesced
+    }' "$tmp/sent" "$tmp/fwd"
+done
@@ -0,0 +1,31 @@
+#!/bin/sh
+# SPDX-License-Identifier: GPL-3.0-or-later
+# Touch contacts, reports and cpu per frame when every contact is sent each
+# frame against --touch-keepalive, over a replayed multi-finger trace. Needs
+# no hardware, reports go to files.
+#
+#   TRACE=<file> KEEPALIVE=<ms> bench/touch-frames.sh
+set -e
+
+bin=$(dirname "$0")/..
+trace=${TRACE:?set TRACE to a trace recorded with --record --use-touchscreen}
+keepalive=${KEEPALIVE:-50}
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+
+printf '%-10s %10s %10s %10s %10s %12s\n' mode frames contacts skipped \
+  reports us/frame
+for mode in full keepalive; do
+  opts=
+  [ $mode = keepalive ] && opts="--touch-keepalive $keepalive"
+  "$bin/pinenote-usb-tablet" --replay "$trace" --use-touchscreen \
+    --output "file:$tmp/r" --stats $opts 2>"$tmp/stats"
+  awk -v mode=$mode '
+    $1 == "cyttsp5" && NF == 6 { reports = $3 }
+    /^cpu time:/ { us = $3 }
+    /^touch:/ { frames = $2; contacts = $4; skipped = $7 }
+    END {
+      printf "%-10s %10d %10d %10d %10d %12.3f\n", mode, frames, contacts,
+             skipped, reports, frames ? us / frames : 0
+    }' "$tmp/stats"
+done
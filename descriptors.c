@@ -0,0 +1,224 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+#include "descriptors.h"
+#include <string.h>
+
+char report_desc_w9013[] = {
+    // hid-decode /dev/hidraw0
+    // w9013 2D1F:0095
+    0x05, 0x0d,       // Usage Page (Digitizers)
+    0x09, 0x02,       // Usage (Pen)
+    0xa1, 0x01,       // Collection (Application)
+    0x85, 0x01,       //  Report ID (1) // added in for bluetooth pen buttons
+    0x09, 0x20,       //  Usage (Stylus)
+    0xa1, 0x00,       //  Collection (Physical)
+    0x09, 0x44,       //   Usage (Barrel Switch)
+    0x09, 0x5a,       //   Usage (Secondary Barrel Switch)
+    0x09, 0x45,       //   Usage (Eraser)
+    0x09, 0x00,       //   Usage (Undefined)
+    0x09, 0x00,       //   Usage (Undefined)
+    0x15, 0x00,       //   Logical Minimum (0)
+    0x25, 0x01,       //   Logical Maximum (1)
+    0x75, 0x01,       //   Report Size (1)
+    0x95, 0x05,       //   Report Count (5)
+    0x81, 0x02,       //   Input (Data,Var,Abs)
+    0x95, 0x03,       //   Report Count (3)
+    0x81, 0x03,       //   Input (Cnst,Var,Abs)
+    0xc0,             //  End Collection
+    0x85, 0x02,       //  Report ID (2)  // seems to be the only one actually
+    0x09, 0x20,       //  Usage (Stylus) // reported by the digitizer
+    0xa1, 0x00,       //  Collection (Physical)
+    0x09, 0x42,       //   Usage (Tip Switch)
+    0x09, 0x44,       //   Usage (Barrel Switch)
+    0x09, 0x45,       //   Usage (Eraser)
+    0x09, 0x3c,       //   Usage (Invert)
+    0x09, 0x5a,       //   Usage (Secondary Barrel Switch)
+    0x09, 0x32,       //   Usage (In Range)
+    0x15, 0x00,       //   Logical Minimum (0)
+    0x25, 0x01,       //   Logical Maximum (1)
+    0x75, 0x01,       //   Report Size (1)
+    0x95, 0x06,       //   Report Count (6)
+    0x81, 0x02,       //   Input (Data,Var,Abs)
+    0x95, 0x02,       //   Report Count (2)
+    0x81, 0x03,       //   Input (Cnst,Var,Abs)
+    0x05, 0x01,       //   Usage Page (Generic Desktop)
+    0x09, 0x30,       //   Usage (X)
+    0x26, 0xe6, 0x51, //   Logical Maximum (20966)
+    0x46, 0xe6, 0x51, //   Physical Maximum (20966)
+    0x65, 0x11,       //   Unit (SILinear: cm)
+    0x55, 0x0d,       //   Unit Exponent (-3)
+    0x75, 0x10,       //   Report Size (16)
+    0x95, 0x01,       //   Report Count (1)
+    0x81, 0x02,       //   Input (Data,Var,Abs)
+    0x09, 0x31,       //   Usage (Y)
+    0x26, 0x6d, 0x3d, //   Logical Maximum (15725)
+    0x46, 0x6d, 0x3d, //   Physical Maximum (15725)
+    0x81, 0x02,       //   Input (Data,Var,Abs)
+    0x45, 0x00,       //   Physical Maximum (0)
+    0x65, 0x00,       //   Unit (None)
+    0x55, 0x00,       //   Unit Exponent (0)
+    0x05, 0x0d,       //   Usage Page (Digitizers)
+    0x09, 0x30,       //   Usage (Tip Pressure)
+    0x26, 0xff, 0x0f, //   Logical Maximum (4095)
+    0x81, 0x02,       //   Input (Data,Var,Abs)
+    0x06, 0x00, 0xff, //   Usage Page (Vendor Defined Page 1)
+    0x09, 0x04,       //   Usage (Vendor Usage 0x04)
+    0x75, 0x08,       //   Report Size (8)
+    0x26, 0xff, 0x00, //   Logical Maximum (255)
+    0x46, 0xff, 0x00, //   Physical Maximum (255)
+    0x65, 0x11,       //   Unit (SILinear: cm)
+    0x55, 0x0e,       //   Unit Exponent (-2)
+    0x81, 0x02,       //   Input (Data,Var,Abs)
+    0x05, 0x0d,       //   Usage Page (Digitizers)
+    0x09, 0x3d,       //   Usage (X Tilt)
+    0x75, 0x10,       //   Report Size (16)
+    0x16, 0xd8, 0xdc, //   Logical Minimum (-9000)
+    0x26, 0x28, 0x23, //   Logical Maximum (9000)
+    0x36, 0xd8, 0xdc, //   Physical Minimum (-9000)
+    0x46, 0x28, 0x23, //   Physical Maximum (9000)
+    0x65, 0x14,       //   Unit (EnglishRotation: deg)
+    0x81, 0x02,       //   Input (Data,Var,Abs)
+    0x09, 0x3e,       //   Usage (Y Tilt)
+    0x81, 0x02,       //   Input (Data,Var,Abs)
+    0x65, 0x00,       //   Unit (None)
+    0x55, 0x00,       //   Unit Exponent (0)
+    0x15, 0x00,       //   Logical Minimum (0)
+    0x35, 0x00,       //   Physical Minimum (0)
+    0x45, 0x00,       //   Physical Maximum (0)
+    0x05, 0x01,       //   Usage Page (Generic Desktop)
+    0x09, 0x32,       //   Usage (Z)
+    0x75, 0x10,       //   Report Size (16)
+    0x16, 0x01, 0xff, //   Logical Minimum (-255)
+    0x25, 0x00,       //   Logical Maximum (0)
+    0x36, 0x01, 0xff, //   Physical Minimum (-255)
+    0x45, 0x00,       //   Physical Maximum (0)
+    0x65, 0x11,       //   Unit (SILinear: cm)
+    0x55, 0x0e,       //   Unit Exponent (-2)
+    0x81, 0x02,       //   Input (Data,Var,Abs)
+    0x15, 0x00,       //   Logical Minimum (0)
+    0x35, 0x00,       //   Physical Minimum (0)
+    0x65, 0x00,       //   Unit (None)
+    0x55, 0x00,       //   Unit Exponent (0)
+    0xc0,             //  End Collection
+    0x09, 0x00,       //  Usage (Undefined)
+    0x75, 0x08,       //  Report Size (8)
+    0x26, 0xff, 0x00, //  Logical Maximum (255)
+    0xb1, 0x12,       //  Feature (Data,Var,Abs,NonLin)
+    0xc0,             // End Collection
+};
+
+const size_t report_desc_w9013_len = sizeof(report_desc_w9013);
+
+// goes into Report ID 2 after Z, before the last End Collection
+static const char report_desc_pen_scan_time[] = {
+    0x05, 0x0d,                   //  Usage Page (Digitizers)
+    0x09, 0x56,                   //  Usage (Scan Time)
+    0x27, 0xff, 0xff, 0x00, 0x00, //  Logical Maximum (65535)
+    0x47, 0xff, 0xff, 0x00, 0x00, //  Physical Maximum (65535)
+    0x66, 0x01, 0x10,             //  Unit (SI Linear: s)
+    0x55, 0x0c,                   //  Unit Exponent (-4)
+    0x75, 0x10,                   //  Report Size (16)
+    0x95, 0x01,                   //  Report Count (1)
+    0x81, 0x02,                   //  Input (Data,Var,Abs)
+};
+
+char report_desc_pen[sizeof(report_desc_w9013) +
+                     sizeof(report_desc_pen_scan_time)];
+
+int build_pen_descriptor(void) {
+  size_t head = sizeof(report_desc_w9013) - 1;
+
+  memcpy(report_desc_pen, report_desc_w9013, head);
+  memcpy(report_desc_pen + head, report_desc_pen_scan_time,
+         sizeof(report_desc_pen_scan_time));
+  report_desc_pen[sizeof(report_desc_pen) - 1] = report_desc_w9013[head];
+  return sizeof(report_desc_pen);
+}
+
+static const char report_desc_touch_head[] = {
+    0x05, 0x0d, // Usage Page (Digitizers)
+    0x09, 0x04, // Usage (Touch Screen) // change to 05 for touchpad
+    0xa1, 0x01, // Collection (Application)
+    0x85, 0x01, //   Report ID (1)
+};
+
+static const char report_desc_touch_finger[] = {
+    0x05, 0x0d,       //   Usage Page (Digitizers)
+    0x09, 0x22,       //   Usage (Finger)
+    0xa1, 0x02,       //   Collection (Logical)
+    0x09, 0x42,       //     Usage (Tip Switch)
+    0x15, 0x00,       //     Logical Minimum (0)
+    0x25, 0x01,       //     Logical Maximum (1)
+    0x75, 0x01,       //     Report Size (1)
+    0x95, 0x01,       //     Report Count (1)
+    0x81, 0x02,       //     Input (Data,Var,Abs)
+    0x75, 0x01,       //     Report Size (1)
+    0x95, 0x03,       //     Report Count (3)
+    0x81, 0x03,       //     Input (Cnst,Var,Abs)
+    0x25, 0x0f,       //     Logical Maximum (15)
+    0x75, 0x04,       //     Report Size (4)
+    0x95, 0x01,       //     Report Count (1)
+    0x09, 0x51,       //     Usage (Contact Id)
+    0x81, 0x02,       //     Input (Data,Var,Abs)
+    0x05, 0x01,       //     Usage Page (Generic Desktop)
+    0x15, 0x00,       //     Logical Minimum (0)
+    0x26, 0x46, 0x07, //     Logical Maximum (1862)
+    0x75, 0x10,       //     Report Size (16)
+    0x55, 0x0e,       //     Unit Exponent (-2)
+    0x65, 0x11,       //     Unit (SILinear: cm)
+    0x09, 0x30,       //     Usage (X)
+    0x35, 0x00,       //     Physical Minimum (0)
+    0x46, 0x46, 0x07, //     Physical Maximum (1862)
+    0x95, 0x01,       //     Report Count (1)
+    0x81, 0x02,       //     Input (Data,Var,Abs)
+    0x26, 0x76, 0x05, //     Logical Maximum (1398)
+    0x09, 0x31,       //     Usage (Y)
+    0x46, 0x76, 0x05, //     Physical Maximum (1398)
+    0x81, 0x02,       //     Input (Data,Var,Abs)
+    0x45, 0x00,       //     Physical Maximum (0)
+    0x65, 0x00,       //     Unit (None)
+    0x55, 0x00,       //     Unit Exponent (0)
+    0xc0,             //   End Collection
+};
+
+static const char report_desc_touch_tail[] = {
+    0x05, 0x0d,                   //   Usage Page (Digitizers)
+    0x15, 0x00,                   //   Logical Minimum (0)
+    0x25, 0x7f,                   //   Logical Maximum (127)
+    0x75, 0x08,                   //   Report Size (8)
+    0x95, 0x01,                   //   Report Count (1)
+    0x09, 0x54,                   //   Usage (Contact Count)
+    0x81, 0x02,                   //   Input (Data,Var,Abs)
+    0x55, 0x0c,                   //   Unit Exponent (-4)
+    0x66, 0x01, 0x10,             //   Unit (SI Linear: s)
+    0x27, 0xff, 0xff, 0x00, 0x00, //   Logical Maximum (65535)
+    0x47, 0xff, 0xff, 0x00, 0x00, //   Physical Maximum (65535)
+    0x75, 0x10,                   //   Report Size (16)
+    0x95, 0x01,                   //   Report Count (1)
+    0x09, 0x56,                   //   Usage (Scan Time)
+    0x81, 0x02,                   //   Input (Data,Var,Abs)
+    0xc0                          // End Collection
+};
+
+char report_desc_touch[sizeof(report_desc_touch_head) +
+                              MAX_SLOTS * sizeof(report_desc_touch_finger) +
+                              sizeof(report_desc_touch_tail)];
+
+int build_touch_descriptor(int contacts) {
+  int len = 0;
+
+  // report_desc_touch has room for MAX_SLOTS finger collections
+  if (contacts < 0 || contacts > MAX_SLOTS)
+    return -1;
+  memcpy(report_desc_touch, report_desc_touch_head,
+         sizeof(report_desc_touch_head));
+  len += sizeof(report_desc_touch_head);
+  for (int i = 0; i < contacts; i++) {
+    memcpy(report_desc_touch + len, report_desc_touch_finger,
+           sizeof(report_desc_touch_finger));
+    len += sizeof(report_desc_touch_finger);
+  }
+  memcpy(report_desc_touch + len, report_desc_touch_tail,
+         sizeof(report_desc_touch_tail));
+  len += sizeof(report_desc_touch_tail);
+  return len;
+}
@@ -0,0 +1,64 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+#ifndef PINENOTE_DESCRIPTORS_H
+#define PINENOTE_DESCRIPTORS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define USBG_VENDOR 0x2d1f
+#define USBG_PRODUCT 0x0095
+#define W9013_VENDOR 0x2d1f
+#define W9013_PRODUCT 0x0095
+
+#define WS8100_PEN_NAME "ws8100_pen"
+#define CYTTSP5_NAME "cyttsp5"
+#define W9013_NAME "w9013 2D1F:0095 Stylus"
+#define W9013_REPORT_LEN 15
+
+// Report ID 2 of report_desc_w9013, the one the digitizer actually sends,
+// and as forwarded with report_desc_pen, which adds Scan Time
+#define PEN_REPORT_ID 0x02
+#define PEN_TIP 0x01
+#define PEN_BARREL 0x02
+#define PEN_ERASER 0x04
+#define PEN_INVERT 0x08
+#define PEN_SECONDARY_BARREL 0x10
+#define PEN_IN_RANGE 0x20
+#define PEN_X 2          // u16
+#define PEN_Y 4          // u16
+#define PEN_PRESSURE 6   // u16
+#define PEN_X_TILT 9     // s16
+#define PEN_Y_TILT 11    // s16
+#define PEN_SCAN_TIME 15 // u16, set by the forwarder
+#define PEN_REPORT_LEN 17
+#define PEN_MAX_X 20966
+#define PEN_MAX_Y 15725
+#define PEN_MAX_PRESSURE 4095
+#define PEN_MAX_TILT 9000
+
+#define MAX_SLOTS 10
+
+// the touch descriptor is assembled at startup from one finger collection per
+// contact carried in a report: MAX_SLOTS for one report per frame, or
+// TOUCH_HYBRID_CONTACTS for hosts that want a frame split across reports
+#define TOUCH_HYBRID_CONTACTS 1
+#define TOUCH_CONTACT_LEN 5
+#define TOUCH_REPORT_LEN(contacts) (1 + (contacts) * TOUCH_CONTACT_LEN + 3)
+
+// the Scan Time of pen and touch reports, a CLOCK_MONOTONIC time in the
+// descriptors' 100 us units, wrapping at 16 bits
+#define HID_SCAN_TIME(t_ns) ((uint16_t)((t_ns) / 100000))
+
+extern char report_desc_w9013[];
+extern const size_t report_desc_w9013_len;
+extern char report_desc_pen[];
+extern char report_desc_touch[];
+
+// fills report_desc_pen and returns its length
+int build_pen_descriptor(void);
+
+// fills report_desc_touch for the given number of contacts per report and
+// returns its length, or -1 for a count outside 0 to MAX_SLOTS
+int build_touch_descriptor(int contacts);
+
+#endif
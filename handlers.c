@@ -0,0 +1,382 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+#include "handlers.h"
+#include "latency.h"
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/timerfd.h>
+
+void publish_pen_proximity(pen_proximity *p, bool in_range, uint64_t t_ns) {
+  uint64_t old = atomic_load_explicit(&p->left_ns, memory_order_relaxed);
+
+  if (in_range && old != PEN_NEAR)
+    atomic_store_explicit(&p->left_ns, PEN_NEAR, memory_order_relaxed);
+  else if (!in_range && old == PEN_NEAR)
+    atomic_store_explicit(&p->left_ns, t_ns, memory_order_relaxed);
+}
+
+bool pen_is_near(pen_proximity *p, uint64_t t_ns) {
+  uint64_t left = atomic_load_explicit(&p->left_ns, memory_order_relaxed);
+
+  return left == PEN_NEAR || (left && t_ns - left < p->holdoff_ns);
+}
+
+void set_tracking_id(slots *touches, int i, int32_t tid) {
+  if (touches->tid[i] != tid)
+    touches->dirty |= 1u << i;
+  touches->tid[i] = tid;
+  if (tid != -1)
+    touches->down |= 1u << i;
+  else
+    touches->down &= ~(1u << i);
+}
+
+// the Report ID 1 bits that have a field in Report ID 2
+#define MERGED_BUTTONS 0x07
+
+static int send_buttons(pen_buttons *b, output *out) {
+  LATENCY_WRITE_BEGIN();
+  if (output_write(out, b->report, 2) != 2 && errno != ESHUTDOWN) {
+    perror("Write failed");
+    return -1;
+  }
+  LATENCY_WRITE_END(LAT_BUTTONS);
+  b->sent++;
+  b->sent_bits = b->report[1];
+  // the pen reports carry the same bits, nothing is left to merge
+  b->pending_bits = 0;
+  return 1;
+}
+
+int pen_buttons_update(pen_buttons *b, output *out, unsigned char bits,
+                       uint64_t t_ns) {
+  unsigned char changed = b->report[1] ^ bits;
+  int written = 0;
+
+  // a press sent as Report ID 1 is released there too, or the host would
+  // keep seeing it pressed in Report ID 1
+  if (b->merge && b->pen_in_range && !(changed & ~MERGED_BUTTONS) &&
+      !(changed & b->sent_bits)) {
+    // a button going back before its change was sent: the change goes out
+    // on its own first, so a click shorter than a pen report is not lost
+    if (changed & b->pending_bits) {
+      if ((written = send_buttons(b, out)) < 0)
+        return -1;
+    }
+    b->report[1] = bits;
+    if (!b->pending_bits)
+      b->pending_ns = t_ns;
+    b->pending_bits |= changed;
+    return written;
+  }
+  b->report[1] = bits;
+  return send_buttons(b, out);
+}
+
+static void merge_buttons(pen_buttons *b, unsigned char *report,
+                          uint64_t t_ns) {
+  unsigned char bits = b->report[1];
+
+  b->pen_in_range = report[1] & PEN_IN_RANGE;
+  report[1] |= (bits & 0x01 ? PEN_BARREL : 0) |
+               (bits & 0x02 ? PEN_SECONDARY_BARREL : 0) |
+               (bits & 0x04 ? PEN_ERASER : 0);
+  if (b->pending_bits) {
+    b->pending_bits = 0;
+    b->merged++;
+    latency_histogram_add(&b->merge_latency,
+                          t_ns > b->pending_ns ? t_ns - b->pending_ns : 0);
+  }
+}
+
+void pen_buttons_print_stats(pen_buttons *b, FILE *out) {
+  if (!b->merge)
+    return;
+  fprintf(out, "buttons: %llu changes merged into pen reports, %llu sent "
+               "as Report ID 1\n",
+          (unsigned long long)b->merged, (unsigned long long)b->sent);
+  if (b->merged)
+    fprintf(out,
+            "button to pen report: p50 %.2f ms, p99 %.2f ms, max %.2f ms\n",
+            latency_histogram_percentile(&b->merge_latency, 0.5) / 1e6,
+            latency_histogram_percentile(&b->merge_latency, 0.99) / 1e6,
+            atomic_load(&b->merge_latency.max) / 1e6);
+}
+
+int handle_ws8100_pen_events(struct input_event ev, void *data, output *out) {
+  pen_buttons *buttons = data;
+  if (ev.type == EV_KEY) {
+    int bit = -1;
+    bool invert = false; // used for when double press event is passed between
+                         // tool down and up to reproduce it with one output
+                         // instead of two.
+                         // (see drivers/input/misc/ws8100-pen.c
+                         // of the kernel)
+    switch (ev.code) {
+    case BTN_TOOL_RUBBER: // button 1 press and release, except it is kept
+                          // pressed during double press
+      bit = 0;
+      break;
+    case KEY_MACRO1: // button 1 double press
+      bit = 0;
+      invert = true;
+      break;
+    case BTN_TOOL_PEN: // button 2 press and release, except it is kept pressed
+                       // during double press
+      bit = 1;
+      break;
+    case KEY_MACRO2: // button 2 double press
+      bit = 1;
+      invert = true;
+      break;
+    case BTN_STYLUS3: // button 3 short press
+      bit = 2;
+      break;
+    case KEY_SLEEP: // button 3 long press
+      bit = 3;
+      break;
+    case KEY_MACRO3: // button 3 double press
+      bit = 4;
+      break;
+    }
+
+    if (bit >= 0) {
+      unsigned char bits = buttons->report[1];
+
+      if (ev.value ^ invert) {
+        bits |= 1 << bit;
+      } else {
+        bits &= ~(1 << bit);
+      }
+      return pen_buttons_update(buttons, out, bits,
+                                ev.time.tv_sec * 1000000000ULL +
+                                    ev.time.tv_usec * 1000ULL);
+    }
+  }
+  return 0;
+}
+
+int handle_cyttsp_events(struct input_event ev, void *data, output *out) {
+  slots *touches = data;
+  int written = 0;
+  int c = touches->current;
+
+  // a slot past MAX_SLOTS, which only a corrupt trace can name, is not
+  // tracked: its events are dropped until the next ABS_MT_SLOT
+  if (ev.type == EV_ABS && ev.code != ABS_MT_SLOT && c >= MAX_SLOTS)
+    return 0;
+  if (ev.type == EV_ABS) {
+    switch (ev.code) {
+    case ABS_MT_SLOT:
+      touches->current =
+          ev.value >= 0 && ev.value < MAX_SLOTS ? ev.value : MAX_SLOTS;
+      break;
+    case ABS_MT_TRACKING_ID:
+      set_tracking_id(touches, c, ev.value);
+      break;
+    case ABS_MT_POSITION_X:
+      if (touches->x[c] != ev.value)
+        touches->dirty |= 1u << c;
+      touches->x[c] = ev.value;
+      break;
+    case ABS_MT_POSITION_Y:
+      if (touches->y[c] != ev.value)
+        touches->dirty |= 1u << c;
+      touches->y[c] = ev.value;
+      break;
+    }
+  } else if (ev.type == EV_SYN && ev.code == SYN_REPORT) {
+    uint8_t report[TOUCH_REPORT_LEN(MAX_SLOTS)];
+    uint8_t contacts[MAX_SLOTS];
+    uint8_t n_touches = 0;
+    int per_report = touches->contacts_per_report;
+    int len = TOUCH_REPORT_LEN(per_report);
+    // the SYN_REPORT carries the time of the whole frame, every report of
+    // it has the same Scan Time
+    uint64_t t_ns = ev.time.tv_sec * 1000000000ULL + ev.time.tv_usec * 1000ULL;
+    uint16_t scan_time = HID_SCAN_TIME(t_ns);
+    // with the pen close, whatever touches the screen is the hand holding
+    // it: lift what the host still sees as down and send nothing else
+    bool palm = touches->palm_rejection &&
+                pen_is_near(touches->palm_rejection, t_ns);
+    uint32_t send;
+    bool hold;
+
+    touches->frames++;
+    if (!touches->down)
+      touches->first_contact_ns = 0;
+    else if (!touches->first_contact_ns)
+      touches->first_contact_ns = t_ns;
+    // with nothing down on the host, a new contact has to last for the
+    // debounce before it is sent, so brushes and noise stay local
+    hold = touches->debounce_ns && !palm && !touches->host_down &&
+           (!touches->down ||
+            t_ns - touches->first_contact_ns < touches->debounce_ns);
+    if (hold) {
+      send = 0;
+      touches->debounced += touches->down != 0;
+    } else if (palm) {
+      send = touches->host_down;
+    } else {
+      send = touches->down | touches->host_down;
+      // with a keepalive, contacts that have not changed since they were
+      // sent are left out until it is due
+      if (touches->keepalive_ns) {
+        if (t_ns - touches->last_full_ns < touches->keepalive_ns)
+          send &= touches->dirty;
+        else
+          touches->last_full_ns = t_ns;
+      }
+      touches->contacts_skipped += __builtin_popcount(
+          (touches->down | touches->host_down) & ~send);
+    }
+    for (uint32_t m = send; m; m &= m - 1)
+      contacts[n_touches++] = __builtin_ctz(m);
+    touches->contacts_sent += n_touches;
+    if (palm && n_touches == 0)
+      touches->suppressed++;
+
+    // all contacts go out in one report, unless the hybrid descriptor is in
+    // use, in which case only the first report of a frame carries the count
+    for (int first = 0; first < n_touches; first += per_report) {
+      memset(report, 0, len);
+      report[0] = 0x01;
+      for (int j = 0; j < per_report && first + j < n_touches; j++) {
+        int i = contacts[first + j];
+        uint8_t *contact = &report[1 + j * TOUCH_CONTACT_LEN];
+        contact[0] =
+            (touches->down >> i & 1 && !palm ? 0x01 : 0x00) | ((i & 0x0F) << 4);
+        memcpy(&contact[1], &touches->x[i], 2);
+        memcpy(&contact[3], &touches->y[i], 2);
+      }
+      report[len - 3] = first == 0 ? n_touches : 0;
+      memcpy(&report[len - 2], &scan_time, 2);
+
+      LATENCY_WRITE_BEGIN();
+      if (output_write(out, report, len) != len && errno != ESHUTDOWN) {
+        perror("Write failed");
+        return -1;
+      }
+      LATENCY_WRITE_END(LAT_TOUCH);
+      written++;
+    }
+
+    touches->dirty &= ~send & touches->down;
+    touches->host_down = palm || hold ? 0 : touches->down;
+  }
+  return written;
+}
+
+static int write_pen_report(output *out, const unsigned char *report,
+                            ssize_t bytes) {
+  LATENCY_WRITE_BEGIN();
+  if (output_write(out, report, bytes) != bytes && errno != ESHUTDOWN) {
+    perror("Write failed");
+    return -1;
+  }
+  LATENCY_WRITE_END(LAT_PEN);
+  return 1;
+}
+
+// a w9013 report as forwarded, with t_ns as its Scan Time
+static int write_pen_sample(output *out, const unsigned char *report,
+                            uint64_t t_ns) {
+  unsigned char buf[PEN_REPORT_LEN];
+  uint16_t scan_time = HID_SCAN_TIME(t_ns);
+
+  memcpy(buf, report, W9013_REPORT_LEN);
+  memcpy(&buf[PEN_SCAN_TIME], &scan_time, 2);
+  return write_pen_report(out, buf, PEN_REPORT_LEN);
+}
+
+// the last step before the output, so resampler ticks are throttled too
+static int send_pen_report(pen_path *pen, output *out,
+                           const unsigned char *report, ssize_t bytes,
+                           uint64_t t_ns) {
+  if (bytes != W9013_REPORT_LEN || report[0] != PEN_REPORT_ID)
+    return write_pen_report(out, report, bytes);
+  if (pen->throttle.enabled && !pen_throttle_pass(&pen->throttle, report, t_ns))
+    return 0;
+  memcpy(pen->last, report, W9013_REPORT_LEN);
+  return write_pen_sample(out, report, t_ns);
+}
+
+void pen_path_set_timer(pen_path *pen) {
+  pen_resample *r = &pen->resample;
+  struct itimerspec its = {0};
+
+  if (pen->timer_fd < 0)
+    return;
+  if (r->running) {
+    its.it_value.tv_sec = r->next_tick_ns / 1000000000;
+    its.it_value.tv_nsec = r->next_tick_ns % 1000000000;
+    its.it_interval.tv_sec = r->period_ns / 1000000000;
+    its.it_interval.tv_nsec = r->period_ns % 1000000000;
+  }
+  timerfd_settime(pen->timer_fd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+int pen_path_forward(pen_path *pen, output *out, const unsigned char *report,
+                     ssize_t bytes, uint64_t t_ns) {
+  unsigned char buf[W9013_REPORT_LEN];
+
+  if (pen->proximity && bytes == W9013_REPORT_LEN &&
+      report[0] == PEN_REPORT_ID)
+    publish_pen_proximity(pen->proximity, report[1] & PEN_IN_RANGE, t_ns);
+  if (bytes == W9013_REPORT_LEN && report[0] == PEN_REPORT_ID &&
+      (pen->filter.enabled || pen->transform.enabled || pen->buttons)) {
+    memcpy(buf, report, bytes);
+    if (pen->filter.enabled)
+      pen_filter_apply(&pen->filter, buf, t_ns);
+    if (pen->transform.enabled)
+      pen_transform_apply(&pen->transform, buf);
+    // before the resampler, which sends a button change as a transition
+    if (pen->buttons)
+      merge_buttons(pen->buttons, buf, t_ns);
+    report = buf;
+  }
+  if (pen->resample.enabled && bytes == W9013_REPORT_LEN &&
+      report[0] == PEN_REPORT_ID) {
+    int flags = pen_resample_push(&pen->resample, report, t_ns);
+
+    if (flags & PEN_RESAMPLE_START)
+      pen_path_set_timer(pen);
+    if (!(flags & PEN_RESAMPLE_EMIT))
+      return 0;
+  }
+  return send_pen_report(pen, out, report, bytes, t_ns);
+}
+
+int pen_path_release(pen_path *pen, output *out, uint64_t t_ns) {
+  unsigned char *last = pen->last;
+  int written = 0;
+
+  if (last[0] == PEN_REPORT_ID && last[1] & PEN_IN_RANGE) {
+    last[1] = 0;
+    written = write_pen_sample(out, last, t_ns);
+  }
+  // no pen report is coming to carry them
+  if (pen->buttons) {
+    pen->buttons->pen_in_range = false;
+    if (pen->buttons->pending_bits && send_buttons(pen->buttons, out) < 0)
+      written = -1;
+  }
+  // the next report starts over, as a transition
+  pen->resample.running = false;
+  pen->resample.n = 0;
+  pen->throttle.primed = false;
+  pen_path_set_timer(pen);
+  return written;
+}
+
+int pen_path_tick(pen_path *pen, output *out, uint64_t tick_ns,
+                  uint64_t late_ns) {
+  unsigned char buf[W9013_REPORT_LEN];
+
+  if (!pen_resample_tick(&pen->resample, tick_ns, late_ns, buf)) {
+    if (!pen->resample.running)
+      pen_path_set_timer(pen);
+    return 0;
+  }
+  return send_pen_report(pen, out, buf, W9013_REPORT_LEN, tick_ns);
+}
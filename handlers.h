@@ -0,0 +1,125 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+#ifndef PINENOTE_HANDLERS_H
+#define PINENOTE_HANDLERS_H
+
+#include "descriptors.h"
+#include "latency.h"
+#include "output.h"
+#include "pen_filter.h"
+#include "pen_resample.h"
+#include "pen_throttle.h"
+#include "pen_transform.h"
+#include <linux/input.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+// The translation from input to HID reports: evdev events and w9013
+// reports go in, reports come out through output_write(). Nothing here
+// opens a device or knows about the event loop, so the forwarder and the
+// microbenchmarks in bench/handlers.c drive the same code. Built, with the
+// modules it uses, into libpinenote.a.
+//
+// Every function returns the number of reports written, or -1 when a
+// write failed for another reason than the host not being there.
+
+// Pen proximity for palm rejection, published by the w9013 path and read
+// by the touch path. It is a single atomic word, so neither side ever
+// waits for the other: PEN_NEAR while the pen is in range, otherwise the
+// time it left, or 0 if it has not been seen yet.
+#define PEN_NEAR UINT64_MAX
+
+typedef struct {
+  _Atomic uint64_t left_ns;
+  uint64_t holdoff_ns;
+} pen_proximity;
+
+void publish_pen_proximity(pen_proximity *p, bool in_range, uint64_t t_ns);
+bool pen_is_near(pen_proximity *p, uint64_t t_ns);
+
+#define ALL_SLOTS ((1u << MAX_SLOTS) - 1)
+
+typedef struct {
+  uint16_t x[MAX_SLOTS];
+  uint16_t y[MAX_SLOTS];
+  int32_t tid[MAX_SLOTS];
+  // one bit per slot: has a tracking id, is down as far as the host knows,
+  // changed since it was last sent
+  uint32_t down;
+  uint32_t host_down;
+  uint32_t dirty;
+  uint8_t current;
+  uint8_t contacts_per_report;
+  pen_proximity *palm_rejection; // NULL when off
+  uint64_t keepalive_ns;         // 0 sends every contact every frame
+  uint64_t last_full_ns;
+  uint64_t debounce_ns; // how long a first contact is held back, 0 for none
+  uint64_t first_contact_ns;
+  uint64_t frames;
+  uint64_t suppressed;
+  uint64_t debounced;
+  uint64_t contacts_sent;
+  uint64_t contacts_skipped;
+} slots;
+
+void set_tracking_id(slots *touches, int i, int32_t tid);
+
+// The ws8100 buttons. Normally every change is sent as Report ID 1 on its
+// own. With merge set (--merge-buttons), a change to a button that has a
+// field in Report ID 2 (1: Barrel, 2: Secondary Barrel, 3: Eraser) is only
+// recorded while the pen is in range, and goes out in the next pen report,
+// in the same transfer and in order with the sample it belongs to. Report
+// ID 1 is then only sent with the pen out of range, and for the long and
+// double presses of button 3, which have no field in Report ID 2. A button
+// the host last saw pressed in Report ID 1 is released in Report ID 1 too.
+typedef struct {
+  unsigned char report[2]; // Report ID 1
+  bool merge;
+  bool pen_in_range; // as of the last pen report, kept while merging
+  unsigned char pending_bits; // changed, waiting for the next pen report
+  unsigned char sent_bits;    // as last sent in Report ID 1
+  uint64_t pending_ns;
+  uint64_t sent;   // as Report ID 1
+  uint64_t merged; // changes carried by a pen report
+  latency_histogram merge_latency; // change to the pen report carrying it
+} pen_buttons;
+
+// sets the button bits of Report ID 1 and sends or merges the change
+int pen_buttons_update(pen_buttons *b, output *out, unsigned char bits,
+                       uint64_t t_ns);
+void pen_buttons_print_stats(pen_buttons *b, FILE *out);
+
+// data is the pen_buttons
+int handle_ws8100_pen_events(struct input_event ev, void *data, output *out);
+// data is the slots; a frame is written on SYN_REPORT
+int handle_cyttsp_events(struct input_event ev, void *data, output *out);
+
+// everything between reading a w9013 report and writing it out
+typedef struct {
+  unsigned char buffer[W9013_REPORT_LEN];
+  unsigned char last[W9013_REPORT_LEN]; // as last sent, for the release
+  pen_filter filter;
+  pen_transform transform;
+  pen_resample resample;
+  pen_throttle throttle;
+  int timer_fd;             // drives the resampler, -1 for none
+  pen_proximity *proximity; // NULL unless palm rejection is on
+  pen_buttons *buttons;     // NULL unless buttons are merged
+} pen_path;
+
+// t_ns is the CLOCK_MONOTONIC time the report was read, sent as its Scan
+// Time
+int pen_path_forward(pen_path *pen, output *out, const unsigned char *report,
+                     ssize_t bytes, uint64_t t_ns);
+// sends the pen out of range if the host last saw it in range, for when
+// the digitizer went away in the middle of a stroke, and button changes
+// still waiting for a pen report as Report ID 1
+int pen_path_release(pen_path *pen, output *out, uint64_t t_ns);
+// sends the resampled report due at tick_ns
+int pen_path_tick(pen_path *pen, output *out, uint64_t tick_ns,
+                  uint64_t late_ns);
+// runs the resampler timer while it has ticks to give, stops it otherwise
+void pen_path_set_timer(pen_path *pen);
+
+#endif
@@ -0,0 +1,99 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+#include "latency.h"
+
+#define SUB_BUCKETS (1 << LAT_SUB_BITS)
+
+static int bucket_index(uint64_t v) {
+  int msb;
+
+  if (v < SUB_BUCKETS)
+    return v;
+  if (v >> (LAT_MAX_MSB + 1))
+    v = (1ULL << (LAT_MAX_MSB + 1)) - 1;
+  msb = 63 - __builtin_clzll(v);
+  return (msb - LAT_SUB_BITS + 1) * SUB_BUCKETS +
+         ((v >> (msb - LAT_SUB_BITS)) & (SUB_BUCKETS - 1));
+}
+
+static uint64_t bucket_value(int idx) {
+  int msb;
+
+  if (idx < SUB_BUCKETS)
+    return idx;
+  msb = idx / SUB_BUCKETS + LAT_SUB_BITS - 1;
+  return (uint64_t)(SUB_BUCKETS + idx % SUB_BUCKETS) << (msb - LAT_SUB_BITS);
+}
+
+void latency_histogram_add(latency_histogram *h, uint64_t v) {
+  uint64_t max = atomic_load_explicit(&h->max, memory_order_relaxed);
+
+  atomic_fetch_add_explicit(&h->count[bucket_index(v)], 1,
+                            memory_order_relaxed);
+  atomic_fetch_add_explicit(&h->total, 1, memory_order_relaxed);
+  while (v > max && !atomic_compare_exchange_weak_explicit(
+                        &h->max, &max, v, memory_order_relaxed,
+                        memory_order_relaxed))
+    ;
+}
+
+uint64_t latency_histogram_percentile(latency_histogram *h, double p) {
+  uint64_t total = atomic_load_explicit(&h->total, memory_order_relaxed);
+  uint64_t want = total * p, seen = 0;
+
+  for (int i = 0; i < LAT_N_BUCKETS; i++) {
+    seen += atomic_load_explicit(&h->count[i], memory_order_relaxed);
+    if (seen > want)
+      return bucket_value(i);
+  }
+  return atomic_load_explicit(&h->max, memory_order_relaxed);
+}
+
+#ifdef LATENCY_TRACE
+#include "trace.h"
+
+static latency_histogram histograms[LAT_N_SOURCES][LAT_N_STAGES];
+
+static const char *source_names[LAT_N_SOURCES] = {"pen", "buttons", "touch"};
+static const char *stage_names[LAT_N_STAGES] = {"wake->read", "read->write",
+                                                "write", "total"};
+
+uint64_t latency_wake_ns, latency_read_ns, latency_write_ns;
+
+void latency_mark(uint64_t *stamp) { *stamp = monotonic_ns(); }
+
+void latency_report(latency_source src) {
+  uint64_t now = monotonic_ns();
+  latency_histogram *h = histograms[src];
+
+  // replayed reports have no loop wakeup in front of them
+  if (latency_wake_ns && latency_wake_ns <= latency_read_ns) {
+    latency_histogram_add(&h[LAT_WAKE_TO_READ],
+                          latency_read_ns - latency_wake_ns);
+    latency_histogram_add(&h[LAT_TOTAL], now - latency_wake_ns);
+  }
+  latency_histogram_add(&h[LAT_READ_TO_WRITE],
+                        latency_write_ns - latency_read_ns);
+  latency_histogram_add(&h[LAT_WRITE], now - latency_write_ns);
+}
+
+void latency_dump(FILE *f) {
+  fprintf(f, "%-8s %-12s %10s %10s %10s %10s %10s\n", "source", "stage",
+          "count", "p50 us", "p99 us", "p99.9 us", "max us");
+  for (int s = 0; s < LAT_N_SOURCES; s++) {
+    for (int st = 0; st < LAT_N_STAGES; st++) {
+      latency_histogram *h = &histograms[s][st];
+      uint64_t total = atomic_load_explicit(&h->total, memory_order_relaxed);
+
+      if (!total)
+        continue;
+      fprintf(f, "%-8s %-12s %10llu %10.1f %10.1f %10.1f %10.1f\n",
+              source_names[s], stage_names[st], (unsigned long long)total,
+              latency_histogram_percentile(h, 0.5) / 1e3,
+              latency_histogram_percentile(h, 0.99) / 1e3,
+              latency_histogram_percentile(h, 0.999) / 1e3,
+              atomic_load_explicit(&h->max, memory_order_relaxed) / 1e3);
+    }
+  }
+}
+
+#endif
@@ -0,0 +1,63 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+#ifndef PINENOTE_LATENCY_H
+#define PINENOTE_LATENCY_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Per-report latency tracing, built with `make LATENCY=1`. Every report is
+// stamped when the loop wakes up, when its input is read, and around the
+// output write; the differences go into log-linear histograms (16 linear
+// sub-buckets per power of two, so ~6% resolution) per source and stage.
+// Without LATENCY_TRACE all of the macros below compile to nothing.
+
+#define LAT_SUB_BITS 4
+#define LAT_MAX_MSB 47
+#define LAT_N_BUCKETS ((LAT_MAX_MSB - LAT_SUB_BITS + 2) << LAT_SUB_BITS)
+
+// always built, also used by the network receiver
+typedef struct {
+  _Atomic uint64_t count[LAT_N_BUCKETS];
+  _Atomic uint64_t total;
+  _Atomic uint64_t max;
+} latency_histogram;
+
+void latency_histogram_add(latency_histogram *h, uint64_t v);
+uint64_t latency_histogram_percentile(latency_histogram *h, double p);
+
+typedef enum { LAT_PEN, LAT_BUTTONS, LAT_TOUCH, LAT_N_SOURCES } latency_source;
+
+typedef enum {
+  LAT_WAKE_TO_READ,
+  LAT_READ_TO_WRITE,
+  LAT_WRITE,
+  LAT_TOTAL,
+  LAT_N_STAGES
+} latency_stage;
+
+#ifdef LATENCY_TRACE
+
+extern uint64_t latency_wake_ns, latency_read_ns, latency_write_ns;
+
+void latency_mark(uint64_t *stamp);
+void latency_report(latency_source src);
+void latency_dump(FILE *f);
+
+#define LATENCY_WAKE() latency_mark(&latency_wake_ns)
+#define LATENCY_READ() latency_mark(&latency_read_ns)
+#define LATENCY_WRITE_BEGIN() latency_mark(&latency_write_ns)
+#define LATENCY_WRITE_END(src) latency_report(src)
+#define LATENCY_DUMP() latency_dump(stderr)
+
+#else
+
+#define LATENCY_WAKE() ((void)0)
+#define LATENCY_READ() ((void)0)
+#define LATENCY_WRITE_BEGIN() ((void)0)
+#define LATENCY_WRITE_END(src) ((void)0)
+#define LATENCY_DUMP() ((void)0)
+
+#endif
+
+#endif
@@ -1,627 +1,1299 @@
 // SPDX-License-Identifier: GPL-3.0-or-later
+#define _GNU_SOURCE
+#include "descriptors.h"
+#include "handlers.h"
+#include "latency.h"
+#include "metrics.h"
 #include "libevdev-1.0/libevdev/libevdev.h"
+#include "output.h"
+#include "pen_filter.h"
+#include "pen_resample.h"
+#include "pen_transform.h"
+#include "trace.h"
+#include "uring.h"
 #include <assert.h>
+#include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <linux/filter.h>
 #include <linux/hidraw.h>
 #include <linux/input.h>
-#include <linux/usb/ch9.h>
+#include <linux/netlink.h>
 #include <poll.h>
-#include <pthread.h>
+#include <sched.h>
 #include <signal.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/timerfd.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
-#include <usbg/function/hid.h>
-#include <usbg/usbg.h>
-
-#define USBG_VENDOR 0x2d1f
-#define USBG_PRODUCT 0x0095
-#define W9013_VENDOR 0x2d1f
-#define W9013_PRODUCT 0x0095
-
-#define WS8100_PEN_NAME "ws8100_pen"
-#define CYTTSP5_NAME "cyttsp5"
-#define W9013_NAME "w9013 2D1F:0095 Stylus"
-
-static char report_desc_w9013[] = {
-    // hid-decode /dev/hidraw0
-    // w9013 2D1F:0095
-    0x05, 0x0d,       // Usage Page (Digitizers)
-    0x09, 0x02,       // Usage (Pen)
-    0xa1, 0x01,       // Collection (Application)
-    0x85, 0x01,       //  Report ID (1) // added in for bluetooth pen buttons
-    0x09, 0x20,       //  Usage (Stylus)
-    0xa1, 0x00,       //  Collection (Physical)
-    0x09, 0x44,       //   Usage (Barrel Switch)
-    0x09, 0x5a,       //   Usage (Secondary Barrel Switch)
-    0x09, 0x45,       //   Usage (Eraser)
-    0x09, 0x00,       //   Usage (Undefined)
-    0x09, 0x00,       //   Usage (Undefined)
-    0x15, 0x00,       //   Logical Minimum (0)
-    0x25, 0x01,       //   Logical Maximum (1)
-    0x75, 0x01,       //   Report Size (1)
-    0x95, 0x05,       //   Report Count (5)
-    0x81, 0x02,       //   Input (Data,Var,Abs)
-    0x95, 0x03,       //   Report Count (3)
-    0x81, 0x03,       //   Input (Cnst,Var,Abs)
-    0xc0,             //  End Collection
-    0x85, 0x02,       //  Report ID (2)  // seems to be the only one actually
-    0x09, 0x20,       //  Usage (Stylus) // reported by the digitizer
-    0xa1, 0x00,       //  Collection (Physical)
-    0x09, 0x42,       //   Usage (Tip Switch)
-    0x09, 0x44,       //   Usage (Barrel Switch)
-    0x09, 0x45,       //   Usage (Eraser)
-    0x09, 0x3c,       //   Usage (Invert)
-    0x09, 0x5a,       //   Usage (Secondary Barrel Switch)
-    0x09, 0x32,       //   Usage (In Range)
-    0x15, 0x00,       //   Logical Minimum (0)
-    0x25, 0x01,       //   Logical Maximum (1)
-    0x75, 0x01,       //   Report Size (1)
-    0x95, 0x06,       //   Report Count (6)
-    0x81, 0x02,       //   Input (Data,Var,Abs)
-    0x95, 0x02,       //   Report Count (2)
-    0x81, 0x03,       //   Input (Cnst,Var,Abs)
-    0x05, 0x01,       //   Usage Page (Generic Desktop)
-    0x09, 0x30,       //   Usage (X)
-    0x26, 0xe6, 0x51, //   Logical Maximum (20966)
-    0x46, 0xe6, 0x51, //   Physical Maximum (20966)
-    0x65, 0x11,       //   Unit (SILinear: cm)
-    0x55, 0x0d,       //   Unit Exponent (-3)
-    0x75, 0x10,       //   Report Size (16)
-    0x95, 0x01,       //   Report Count (1)
-    0x81, 0x02,       //   Input (Data,Var,Abs)
-    0x09, 0x31,       //   Usage (Y)
-    0x26, 0x6d, 0x3d, //   Logical Maximum (15725)
-    0x46, 0x6d, 0x3d, //   Physical Maximum (15725)
-    0x81, 0x02,       //   Input (Data,Var,Abs)
-    0x45, 0x00,       //   Physical Maximum (0)
-    0x65, 0x00,       //   Unit (None)
-    0x55, 0x00,       //   Unit Exponent (0)
-    0x05, 0x0d,       //   Usage Page (Digitizers)
-    0x09, 0x30,       //   Usage (Tip Pressure)
-    0x26, 0xff, 0x0f, //   Logical Maximum (4095)
-    0x81, 0x02,       //   Input (Data,Var,Abs)
-    0x06, 0x00, 0xff, //   Usage Page (Vendor Defined Page 1)
-    0x09, 0x04,       //   Usage (Vendor Usage 0x04)
-    0x75, 0x08,       //   Report Size (8)
-    0x26, 0xff, 0x00, //   Logical Maximum (255)
-    0x46, 0xff, 0x00, //   Physical Maximum (255)
-    0x65, 0x11,       //   Unit (SILinear: cm)
-    0x55, 0x0e,       //   Unit Exponent (-2)
-    0x81, 0x02,       //   Input (Data,Var,Abs)
-    0x05, 0x0d,       //   Usage Page (Digitizers)
-    0x09, 0x3d,       //   Usage (X Tilt)
-    0x75, 0x10,       //   Report Size (16)
-    0x16, 0xd8, 0xdc, //   Logical Minimum (-9000)
-    0x26, 0x28, 0x23, //   Logical Maximum (9000)
-    0x36, 0xd8, 0xdc, //   Physical Minimum (-9000)
-    0x46, 0x28, 0x23, //   Physical Maximum (9000)
-    0x65, 0x14,       //   Unit (EnglishRotation: deg)
-    0x81, 0x02,       //   Input (Data,Var,Abs)
-    0x09, 0x3e,       //   Usage (Y Tilt)
-    0x81, 0x02,       //   Input (Data,Var,Abs)
-    0x65, 0x00,       //   Unit (None)
-    0x55, 0x00,       //   Unit Exponent (0)
-    0x15, 0x00,       //   Logical Minimum (0)
-    0x35, 0x00,       //   Physical Minimum (0)
-    0x45, 0x00,       //   Physical Maximum (0)
-    0x05, 0x01,       //   Usage Page (Generic Desktop)
-    0x09, 0x32,       //   Usage (Z)
-    0x75, 0x10,       //   Report Size (16)
-    0x16, 0x01, 0xff, //   Logical Minimum (-255)
-    0x25, 0x00,       //   Logical Maximum (0)
-    0x36, 0x01, 0xff, //   Physical Minimum (-255)
-    0x45, 0x00,       //   Physical Maximum (0)
-    0x65, 0x11,       //   Unit (SILinear: cm)
-    0x55, 0x0e,       //   Unit Exponent (-2)
-    0x81, 0x02,       //   Input (Data,Var,Abs)
-    0x15, 0x00,       //   Logical Minimum (0)
-    0x35, 0x00,       //   Physical Minimum (0)
-    0x65, 0x00,       //   Unit (None)
-    0x55, 0x00,       //   Unit Exponent (0)
-    0xc0,             //  End Collection
-    0x09, 0x00,       //  Usage (Undefined)
-    0x75, 0x08,       //  Report Size (8)
-    0x26, 0xff, 0x00, //  Logical Maximum (255)
-    0xb1, 0x12,       //  Feature (Data,Var,Abs,NonLin)
-    0xc0,             // End Collection
-};
 
-static char report_desc_touch[] = {
-    0x05, 0x0d,       // Usage Page (Digitizers)
-    0x09, 0x04,       // Usage (Touch Screen) // change to 05 for touchpad
-    0xa1, 0x01,       // Collection (Application)
-    0x85, 0x01,       //   Report ID (1)
-    0x09, 0x22,       //   Usage (Finger)
-    0xa1, 0x02,       //   Collection (Logical)
-    0x09, 0x42,       //     Usage (Tip Switch)
-    0x15, 0x00,       //     Logical Minimum (0)
-    0x25, 0x01,       //     Logical Maximum (1)
-    0x75, 0x01,       //     Report Size (1)
-    0x95, 0x01,       //     Report Count (1)
-    0x81, 0x02,       //     Input (Data,Var,Abs)
-    0x75, 0x01,       //     Report Size (1)
-    0x95, 0x03,       //     Report Count (3)
-    0x81, 0x03,       //     Input (Cnst,Var,Abs)
-    0x25, 0x0f,       //     Logical Maximum (15)
-    0x75, 0x04,       //     Report Size (4)
-    0x95, 0x01,       //     Report Count (1)
-    0x09, 0x51,       //     Usage (Contact Id)
-    0x81, 0x02,       //     Input (Data,Var,Abs)
-    0x05, 0x01,       //     Usage Page (Generic Desktop)
-    0x15, 0x00,       //     Logical Minimum (0)
-    0x26, 0x46, 0x07, //     Logical Maximum (1862)
-    0x75, 0x10,       //     Report Size (16)
-    0x55, 0x0e,       //     Unit Exponent (-2)
-    0x65, 0x11,       //     Unit (SILinear: cm)
-    0x09, 0x30,       //     Usage (X)
-    0x35, 0x00,       //     Physical Minimum (0)
-    0x46, 0x46, 0x07, //     Physical Maximum (1862)
-    0x95, 0x01,       //     Report Count (1)
-    0x81, 0x02,       //     Input (Data,Var,Abs)
-    0x26, 0x76, 0x05, //     Logical Maximum (1398)
-    0x09, 0x31,       //     Usage (Y)
-    0x46, 0x76, 0x05, //     Physical Maximum (1398)
-    0x81, 0x02,       //     Input (Data,Var,Abs)
-    0xc0,             //   End Collection
-    0x05, 0x0d,       //   Usage Page (Digitizers)
-    0x15, 0x00,       //   Logical Minimum (0)
-    0x25, 0x7f,       //   Logical Maximum (127)
-    0x75, 0x08,       //   Report Size (8)
-    0x95, 0x01,       //   Report Count (1)
-    0x09, 0x54,       //   Usage (Contact Count)
-    0x81, 0x02,       //   Input (Data,Var,Abs)
-    0x55, 0x0c,       //   Unit Exponent (-4)
-    0x66, 0x01, 0x10, //   Unit (SI Linear: s)
-    0x27, 0xff, 0xff, 0x00, 0x00, //   Logical Maximum (65535)
-    0x47, 0xff, 0xff, 0x00, 0x00, //   Physical Maximum (65535)
-    0x75, 0x10,                   //   Report Size (16)
-    0x95, 0x01,                   //   Report Count (1)
-    0x09, 0x56,                   //   Usage (Scan Time)
-    0x81, 0x02,                   //   Input (Data,Var,Abs)
-    0xc0                          // End Collection
-};
+// Device nodes by what they are, found from sysfs in one pass over the
+// input and hidraw classes. Nothing is opened to learn its name, which
+// would also power up every device that has an open() hook.
+typedef struct {
+  char w9013[280];
+  char w9013_evdev[280];
+  char ws8100_pen[280];
+  char cyttsp5[280];
+} device_nodes;
 
-#define MAX_SLOTS 10
+int read_sysfs(const char *path, char *buf, size_t size) {
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  ssize_t n;
 
-typedef struct {
-  uint16_t x[MAX_SLOTS];
-  uint16_t y[MAX_SLOTS];
-  int32_t tid[MAX_SLOTS];
-  bool lifted[MAX_SLOTS];
-  uint8_t current;
-} slots;
+  if (fd < 0)
+    return -1;
+  n = read(fd, buf, size - 1);
+  close(fd);
+  if (n < 0)
+    return -1;
+  buf[n] = '\0';
+  return 0;
+}
 
-typedef struct {
-  usbg_state *s;
-  usbg_gadget *g;
-  usbg_config *c;
-  usbg_function *f_hid_w9013;
-  usbg_function *f_hid_touch;
-} usbg_context;
-
-int remove_gadget(usbg_gadget *g) {
-  int usbg_ret;
-  usbg_udc *u;
-
-  /* Check if gadget is enabled */
-  u = usbg_get_gadget_udc(g);
-
-  /* If gadget is enable we have to disable it first */
-  if (u) {
-    usbg_ret = usbg_disable_gadget(g);
-    if (usbg_ret != USBG_SUCCESS) {
-      fprintf(stderr, "Error on USB disable gadget udc\n");
-      fprintf(stderr, "Error: %s : %s\n", usbg_error_name(usbg_ret),
-              usbg_strerror(usbg_ret));
-      goto out;
+void find_device_nodes(device_nodes *nodes) {
+  struct {
+    const char *name;
+    char *node;
+  } evdevs[] = {{W9013_NAME, nodes->w9013_evdev},
+                {WS8100_PEN_NAME, nodes->ws8100_pen},
+                {CYTTSP5_NAME, nodes->cyttsp5}};
+  char path[300], buf[512];
+  struct dirent *ent;
+  DIR *dir;
+
+  memset(nodes, 0, sizeof(*nodes));
+  if ((dir = opendir("/sys/class/input"))) {
+    while ((ent = readdir(dir))) {
+      if (strncmp(ent->d_name, "event", 5) != 0)
+        continue;
+      snprintf(path, sizeof(path), "/sys/class/input/%s/device/name",
+               ent->d_name);
+      if (read_sysfs(path, buf, sizeof(buf)) < 0)
+        continue;
+      buf[strcspn(buf, "\n")] = '\0';
+      for (size_t i = 0; i < sizeof(evdevs) / sizeof(evdevs[0]); i++) {
+        if (!evdevs[i].node[0] && strcmp(buf, evdevs[i].name) == 0)
+          snprintf(evdevs[i].node, sizeof(nodes->w9013), "/dev/input/%s",
+                   ent->d_name);
+      }
     }
+    closedir(dir);
   }
+  if ((dir = opendir("/sys/class/hidraw"))) {
+    while ((ent = readdir(dir))) {
+      unsigned int bus, vid, pid;
+      char *id;
 
-  /* Remove gadget with USBG_RM_RECURSE flag to remove
-   * also its configurations, functions and strings */
-  usbg_ret = usbg_rm_gadget(g, USBG_RM_RECURSE);
-  if (usbg_ret != USBG_SUCCESS) {
-    fprintf(stderr, "Error on USB gadget remove\n");
-    fprintf(stderr, "Error: %s : %s\n", usbg_error_name(usbg_ret),
-            usbg_strerror(usbg_ret));
+      if (strncmp(ent->d_name, "hidraw", 6) != 0 || nodes->w9013[0])
+        continue;
+      snprintf(path, sizeof(path), "/sys/class/hidraw/%s/device/uevent",
+               ent->d_name);
+      if (read_sysfs(path, buf, sizeof(buf)) < 0 ||
+          !(id = strstr(buf, "HID_ID=")) ||
+          sscanf(id, "HID_ID=%x:%x:%x", &bus, &vid, &pid) != 3)
+        continue;
+      // --output uhid creates hidraw nodes with the same ids, on the
+      // virtual bus; the digitizer, and virtual-input's stand-in, are i2c
+      if (bus == BUS_I2C && vid == W9013_VENDOR && pid == W9013_PRODUCT)
+        snprintf(nodes->w9013, sizeof(nodes->w9013), "/dev/%s", ent->d_name);
+    }
+    closedir(dir);
+  }
+}
+
+// the node may have been reused since sysfs was read, so what sysfs said is
+// checked again on the open device
+int open_hidraw_node(const char *node, const char *device, uint16_t vid,
+                     uint16_t pid) {
+  struct hidraw_devinfo hidinfo;
+  int fd;
+
+  if (!node[0] || (fd = open(node, O_RDWR | O_NONBLOCK)) < 0)
+    return -1;
+  if (ioctl(fd, HIDIOCGRAWINFO, &hidinfo) < 0 || hidinfo.bustype != BUS_I2C ||
+      (uint16_t)hidinfo.vendor != vid || (uint16_t)hidinfo.product != pid) {
+    close(fd);
+    return -1;
   }
+  printf("Found %s at: %s\n", device, node);
+  return fd;
+}
+
+int open_evdev_node(const char *node, const char *name,
+                    struct libevdev **out_dev) {
+  int fd;
 
-out:
-  return usbg_ret;
+  if (!node[0] || (fd = open(node, O_RDWR | O_NONBLOCK)) < 0)
+    return -1;
+  if (libevdev_new_from_fd(fd, out_dev) < 0) {
+    close(fd);
+    return -1;
+  }
+  if (strcmp(libevdev_get_name(*out_dev), name) != 0) {
+    libevdev_free(*out_dev);
+    *out_dev = NULL;
+    close(fd);
+    return -1;
+  }
+  printf("Found %s at: %s\n", name, node);
+  return 0;
 }
 
-int initUSB(usbg_context *usb_ctx, bool use_cyttsp5, uint16_t vendor,
-            uint16_t product) {
-  int usbg_ret = -EINVAL;
+typedef int (*evdev_handler_fn)(struct input_event, void *data, output *out);
 
-  usbg_gadget *old_gadget = NULL;
-  struct usbg_gadget_attrs g_attrs = {
-      .bcdUSB = 0x0200,
-      .bDeviceClass = USB_CLASS_PER_INTERFACE,
-      .bDeviceSubClass = 0x00,
-      .bDeviceProtocol = 0x00,
-      .bMaxPacketSize0 = 64, /* Max allowed ep0 packet size */
-      .idVendor = vendor,
-      .idProduct = product,
-      .bcdDevice = 0x0100, /* Verson of device */
-  };
-  struct usbg_gadget_strs g_strs = {
-      .serial = "fedcba9876543210", /* Serial number */
-      .manufacturer = "Pine64",     /* Manufacturer */
-      .product = "PineNote"         /* Product string */
-  };
-  struct usbg_config_strs c_strs = {.configuration = "2xHID"};
-  struct usbg_f_hid_attrs f_attrs_ws9013 = {
-      .protocol = 0,
-      .report_desc =
-          {
-              .desc = report_desc_w9013,
-              .len = sizeof(report_desc_w9013),
-          },
-      .report_length = 15,
-      .subclass = 0,
-  };
-  struct usbg_f_hid_attrs f_attrs_touch = {
-      .protocol = 0,
-      .report_desc =
-          {
-              .desc = report_desc_touch,
-              .len = sizeof(report_desc_touch),
-          },
-      .report_length = 9,
-      .subclass = 0,
-  };
+typedef struct source source;
+
+// returns the number of reports written, -1 on error, or SOURCE_LOST when
+// the device behind the source went away
+typedef int (*source_fn)(source *src);
+
+typedef int (*evdev_batch_fn)(source *src, const struct input_event *ev,
+                              int n);
+
+#define SOURCE_LOST -2
+
+struct source {
+  const char *name;
+  int fd;
+  source_fn handle;
+  struct libevdev *dev;
+  void *data;
+  output *out;
+  evdev_handler_fn handler; // one event at a time, for replay
+  evdev_batch_fn batch;
+  source_fn resync; // rebuilds state from libevdev after SYN_DROPPED
+  trace_writer *trace;      // set while recording
+  uint8_t trace_source;
+  uint64_t wakeups;
+  uint64_t syscalls; // reads, and writes of the reports it produced
+  uint64_t reports;
+  uint64_t reads;
+  uint64_t events;
+  uint64_t resyncs;
+  uint64_t lost_ns;
+  uint64_t reconnects;
+  uint64_t reconnect_ns_sum;
+  uint64_t reconnect_ns_max;
+  metrics_source *metrics; // the same counts, for --metrics
+};
+
+int handle_resample_source(source *src) {
+  pen_path *pen = src->data;
+  pen_resample *r = &pen->resample;
+  uint64_t expirations, tick;
 
-  usbg_ret = usbg_init("/sys/kernel/config", &usb_ctx->s);
-  if (usbg_ret != USBG_SUCCESS) {
-    fprintf(stderr, "Error on usbg init\n");
-    fprintf(stderr, "Error: %s : %s\n", usbg_error_name(usbg_ret),
-            usbg_strerror(usbg_ret));
-    goto out1;
-  }
-
-  old_gadget = usbg_get_gadget(usb_ctx->s, "pinenote-usb-tablet");
-  if (old_gadget) {
-    fprintf(stderr, "Removing leftover gadget\n");
-    usbg_ret = remove_gadget(old_gadget);
-    if (usbg_ret != USBG_SUCCESS)
-      goto out2;
-  }
-
-  usbg_ret = usbg_create_gadget(usb_ctx->s, "pinenote-usb-tablet", &g_attrs,
-                                &g_strs, &usb_ctx->g);
-  if (usbg_ret != USBG_SUCCESS) {
-    fprintf(stderr, "Error creating gadget\n");
-    fprintf(stderr, "Error: %s : %s\n", usbg_error_name(usbg_ret),
-            usbg_strerror(usbg_ret));
-    goto out2;
-  }
-  usbg_ret = usbg_create_function(usb_ctx->g, USBG_F_HID, "usb0",
-                                  &f_attrs_ws9013, &usb_ctx->f_hid_w9013);
-  if (usbg_ret != USBG_SUCCESS) {
-    fprintf(stderr, "Error creating function\n");
-    fprintf(stderr, "Error: %s : %s\n", usbg_error_name(usbg_ret),
-            usbg_strerror(usbg_ret));
-    goto out2;
+  src->syscalls++;
+  if (read(src->fd, &expirations, sizeof(expirations)) != sizeof(expirations))
+    return 0;
+  // when the loop was held up, only the latest tick is worth sending
+  tick = r->next_tick_ns + (expirations - 1) * r->period_ns;
+  r->missed += expirations - 1;
+  r->next_tick_ns = tick + r->period_ns;
+  return pen_path_tick(pen, src->out, tick, monotonic_ns() - tick);
+}
+
+// the writer reports a failure, the source stops recording after it
+void record(source *src, const void *data, uint8_t len) {
+  if (trace_write(src->trace, src->trace_source, data, len) < 0)
+    src->trace = NULL;
+}
+
+// a report read into pen->buffer; hidraw has no timestamps of its own, the
+// report is stamped as it is taken in
+int consume_pen_report(source *src, ssize_t bytes) {
+  pen_path *pen = src->data;
+  uint64_t t_ns = monotonic_ns();
+
+  LATENCY_READ();
+  if (src->trace)
+    record(src, pen->buffer, bytes);
+  return pen_path_forward(pen, src->out, pen->buffer, bytes, t_ns);
+}
+
+int handle_hidraw_source(source *src) {
+  pen_path *pen = src->data;
+  ssize_t bytes;
+  int written = 0;
+
+  while ((bytes = read(src->fd, pen->buffer, W9013_REPORT_LEN)) > 0) {
+    int r;
+
+    src->syscalls++;
+    if ((r = consume_pen_report(src, bytes)) < 0)
+      return -1;
+    written += r;
   }
-  if (use_cyttsp5) {
-    usbg_ret = usbg_create_function(usb_ctx->g, USBG_F_HID, "usb1",
-                                    &f_attrs_touch, &usb_ctx->f_hid_touch);
-    if (usbg_ret != USBG_SUCCESS) {
-      fprintf(stderr, "Error creating function\n");
-      fprintf(stderr, "Error: %s : %s\n", usbg_error_name(usbg_ret),
-              usbg_strerror(usbg_ret));
-      goto out2;
-    }
+  src->syscalls++;
+  if (bytes < 0 && errno != EAGAIN) {
+    if (errno == ENODEV || errno == EIO)
+      return SOURCE_LOST;
+    perror("Read failed");
+    return -1;
   }
-  usbg_ret = usbg_create_config(usb_ctx->g, 1, "The only one", NULL, &c_strs,
-                                &usb_ctx->c);
-  if (usbg_ret != USBG_SUCCESS) {
-    fprintf(stderr, "Error creating config\n");
-    fprintf(stderr, "Error: %s : %s\n", usbg_error_name(usbg_ret),
-            usbg_strerror(usbg_ret));
-    goto out2;
-  }
-  usbg_ret =
-      usbg_add_config_function(usb_ctx->c, "w9013", usb_ctx->f_hid_w9013);
-  if (usbg_ret != USBG_SUCCESS) {
-    fprintf(stderr, "Error adding function\n");
-    fprintf(stderr, "Error: %s : %s\n", usbg_error_name(usbg_ret),
-            usbg_strerror(usbg_ret));
-    goto out2;
+  return written;
+}
+
+// the per-device batch loops call their handler directly rather than
+// through src->handler for every event
+int ws8100_pen_batch(source *src, const struct input_event *ev, int n) {
+  int r, written = 0;
+
+  for (int i = 0; i < n; i++) {
+    if ((r = handle_ws8100_pen_events(ev[i], src->data, src->out)) < 0)
+      return -1;
+    written += r;
   }
-  if (use_cyttsp5) {
-    usbg_ret =
-        usbg_add_config_function(usb_ctx->c, "touch", usb_ctx->f_hid_touch);
-    if (usbg_ret != USBG_SUCCESS) {
-      fprintf(stderr, "Error adding function\n");
-      fprintf(stderr, "Error: %s : %s\n", usbg_error_name(usbg_ret),
-              usbg_strerror(usbg_ret));
-      goto out2;
+  return written;
+}
+
+int cyttsp_batch(source *src, const struct input_event *ev, int n) {
+  int r, written = 0;
+
+  for (int i = 0; i < n; i++) {
+    if ((r = handle_cyttsp_events(ev[i], src->data, src->out)) < 0)
+      return -1;
+    written += r;
+  }
+  return written;
+}
+
+// double presses in flight when events were dropped are lost, only the held
+// buttons are restored
+int ws8100_pen_resync(source *src) {
+  static const unsigned int codes[] = {BTN_TOOL_RUBBER, BTN_TOOL_PEN,
+                                       BTN_STYLUS3, KEY_SLEEP};
+  pen_buttons *buttons = src->data;
+  unsigned char bits = 0;
+
+  for (int bit = 0; bit < 4; bit++) {
+    if (libevdev_get_event_value(src->dev, EV_KEY, codes[bit]))
+      bits |= 1 << bit;
+  }
+  if (bits == buttons->report[1])
+    return 0;
+  return pen_buttons_update(buttons, src->out, bits, monotonic_ns());
+}
+
+int cyttsp_resync(source *src) {
+  slots *touches = src->data;
+  struct input_event syn = {.type = EV_SYN, .code = SYN_REPORT};
+  int n_slots = libevdev_get_num_slots(src->dev);
+  uint64_t now = monotonic_ns();
+
+  for (int i = 0; i < MAX_SLOTS; i++) {
+    set_tracking_id(touches, i,
+                    i < n_slots ? libevdev_get_slot_value(
+                                      src->dev, i, ABS_MT_TRACKING_ID)
+                                : -1);
+    if (i >= n_slots)
+      continue;
+    touches->x[i] = libevdev_get_slot_value(src->dev, i, ABS_MT_POSITION_X);
+    touches->y[i] = libevdev_get_slot_value(src->dev, i, ABS_MT_POSITION_Y);
+  }
+  touches->current = libevdev_get_current_slot(src->dev);
+  // whatever was dropped may have moved anything
+  touches->dirty = ALL_SLOTS;
+  syn.time.tv_sec = now / 1000000000;
+  syn.time.tv_usec = now / 1000 % 1000000;
+  return handle_cyttsp_events(syn, touches, src->out);
+}
+
+// The kernel dropped events. libevdev discards what is still queued and
+// re-reads the device state, which the device specific code then turns
+// back into its own.
+int resync_evdev(source *src) {
+  struct input_event ev;
+  int rc = libevdev_next_event(src->dev, LIBEVDEV_READ_FLAG_FORCE_SYNC, &ev);
+
+  while (rc == LIBEVDEV_READ_STATUS_SYNC)
+    rc = libevdev_next_event(src->dev, LIBEVDEV_READ_FLAG_SYNC, &ev);
+  if (rc == -ENODEV)
+    return SOURCE_LOST;
+  // counted for --stats rather than printed, this runs when the loop is
+  // already behind
+  src->resyncs++;
+  metrics_add(&src->metrics->resyncs, 1);
+  return src->resync(src);
+}
+
+#define EVDEV_BATCH 64
+
+// one read worth of events
+int consume_evdev_events(source *src, const struct input_event *evs, int n) {
+  bool dropped = false;
+  int r, written;
+
+  LATENCY_READ();
+  src->reads++;
+  src->events += n;
+  metrics_add(&src->metrics->events, n);
+  for (int i = 0; i < n; i++) {
+    if (evs[i].type == EV_SYN && evs[i].code == SYN_DROPPED) {
+      n = i;
+      dropped = true;
+      break;
     }
   }
-  usbg_ret = usbg_enable_gadget(usb_ctx->g, DEFAULT_UDC);
-  if (usbg_ret != USBG_SUCCESS) {
-    fprintf(stderr, "Error enabling gadget\n");
-    fprintf(stderr, "Error: %s : %s\n", usbg_error_name(usbg_ret),
-            usbg_strerror(usbg_ret));
-    goto out2;
+  for (int i = 0; i < n && src->trace; i++) {
+    trace_input_event tev = {evs[i].type, evs[i].code, evs[i].value};
+    record(src, &tev, sizeof(tev));
   }
-  usbg_ret = 0;
-  goto out1;
+  if ((written = src->batch(src, evs, n)) < 0)
+    return -1;
+  if (dropped) {
+    if ((r = resync_evdev(src)) < 0)
+      return r;
+    written += r;
+  }
+  return written;
+}
 
-out2:
-  usbg_cleanup(usb_ctx->s);
-  usb_ctx->s = NULL;
+// reads as many events as the kernel has queued with one syscall per
+// EVDEV_BATCH, libevdev is only used to recover from SYN_DROPPED
+int handle_evdev_batch_source(source *src) {
+  struct input_event evs[EVDEV_BATCH];
+  ssize_t bytes;
+  int r, written = 0;
 
-out1:
-  return usbg_ret;
+  while ((bytes = read(src->fd, evs, sizeof(evs))) > 0) {
+    src->syscalls++;
+    if ((r = consume_evdev_events(src, evs, bytes / sizeof(evs[0]))) < 0)
+      return r;
+    written += r;
+    // evdev hands out everything queued that fits, a short read means the
+    // queue is empty and another read would only return EAGAIN; after
+    // SYN_DROPPED the kernel has emptied it as well
+    if (bytes < (ssize_t)sizeof(evs))
+      return written;
+  }
+  src->syscalls++;
+  if (bytes < 0 && errno != EAGAIN) {
+    if (errno == ENODEV)
+      return SOURCE_LOST;
+    perror("Read failed");
+    return -1;
+  }
+  return written;
 }
 
-int cleanupUSB(usbg_context *usb_ctx) {
-  if (usb_ctx->g) {
-    usbg_disable_gadget(usb_ctx->g);
-    usbg_rm_gadget(usb_ctx->g, USBG_RM_RECURSE);
+int dispatch_evdev_event(source *src, struct input_event *ev) {
+  LATENCY_READ();
+  src->events++;
+  metrics_add(&src->metrics->events, 1);
+  if (src->trace) {
+    trace_input_event tev = {ev->type, ev->code, ev->value};
+    record(src, &tev, sizeof(tev));
   }
-  if (usb_ctx->s) {
-    usbg_cleanup(usb_ctx->s);
+  return src->handler(*ev, src->data, src->out);
+}
+
+int handle_evdev_source(source *src) {
+  int evdev_rc, n, written = 0;
+  struct input_event ev;
+
+  do {
+    evdev_rc = libevdev_next_event(src->dev, LIBEVDEV_READ_FLAG_NORMAL, &ev);
+    if (evdev_rc == LIBEVDEV_READ_STATUS_SYNC) {
+      src->resyncs++;
+      metrics_add(&src->metrics->resyncs, 1);
+      while (evdev_rc == LIBEVDEV_READ_STATUS_SYNC) {
+        evdev_rc = libevdev_next_event(src->dev, LIBEVDEV_READ_FLAG_SYNC, &ev);
+        if ((n = dispatch_evdev_event(src, &ev)) < 0)
+          return -1;
+        written += n;
+      }
+    } else if (evdev_rc == LIBEVDEV_READ_STATUS_SUCCESS) {
+      if ((n = dispatch_evdev_event(src, &ev)) < 0)
+        return -1;
+      written += n;
+    } else if (evdev_rc == -ENODEV) {
+      return SOURCE_LOST;
+    } else {
+      fprintf(stderr, "Failed to handle events: %s\n", strerror(-evdev_rc));
+      return -1;
+    }
+  } while (libevdev_has_event_pending(src->dev));
+  return written;
+}
+
+int handle_output_source(source *src) {
+  output *out = src->data;
+
+  if (out->handle_events) {
+    src->syscalls++;
+    if (out->handle_events(out) < 0)
+      return -1;
+  }
+  return output_flush(out);
+}
+
+int handle_signal_source(source *src) {
+  struct signalfd_siginfo si;
+
+  src->syscalls++;
+  if (read(src->fd, &si, sizeof(si)) != sizeof(si)) {
+    perror("Failed to read signal");
+    return -1;
+  }
+  if (si.ssi_signo == SIGUSR1) {
+    LATENCY_DUMP();
+    return 0;
+  }
+  // anything else means shutdown
+  return -1;
+}
+
+int add_source(int epfd, source *src) {
+  struct epoll_event ev = {.events = EPOLLIN, .data.ptr = src};
+
+  if (epoll_ctl(epfd, EPOLL_CTL_ADD, src->fd, &ev) < 0) {
+    fprintf(stderr, "Failed to watch %s: %s\n", src->name, strerror(errno));
+    return -1;
   }
   return 0;
 }
 
-int find_hidraw_device(char *device, int16_t vid, int16_t pid) {
-  int fd;
-  struct hidraw_devinfo hidinfo;
-  char path[20];
+void print_stats(source *sources, int n_sources, uint64_t wakeups,
+                 uint64_t loop_syscalls, const struct timespec *start) {
+  struct rusage ru;
+  struct timespec end;
+  double cpu_us, wall_s;
+  uint64_t reports = 0, syscalls = loop_syscalls;
 
-  for (int x = 0; x < 16; x++) {
-    sprintf(path, "/dev/hidraw%d", x);
+  getrusage(RUSAGE_SELF, &ru);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  cpu_us = (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1e6 +
+           ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+  wall_s = (end.tv_sec - start->tv_sec) + (end.tv_nsec - start->tv_nsec) / 1e9;
 
-    if ((fd = open(path, O_RDWR | O_NONBLOCK)) == -1) {
+  fprintf(stderr, "%-12s %12s %12s %14s %10s %10s\n", "source", "wakeups",
+          "reports", "wakeups/report", "wakeups/s", "syscalls/s");
+  for (int i = 0; i < n_sources; i++) {
+    source *src = &sources[i];
+    if (!src->handle)
       continue;
+    reports += src->reports;
+    syscalls += src->syscalls;
+    fprintf(stderr, "%-12s %12llu %12llu %14.3f %10.1f %10.1f\n", src->name,
+            (unsigned long long)src->wakeups, (unsigned long long)src->reports,
+            src->reports ? (double)src->wakeups / src->reports : 0.0,
+            wall_s > 0 ? src->wakeups / wall_s : 0.0,
+            wall_s > 0 ? src->syscalls / wall_s : 0.0);
+  }
+  for (int i = 0; i < n_sources; i++) {
+    source *src = &sources[i];
+    if (!src->reconnects)
+      continue;
+    fprintf(stderr, "%s: %llu reconnects, mean %.1f ms, max %.1f ms\n",
+            src->name, (unsigned long long)src->reconnects,
+            src->reconnect_ns_sum / 1e6 / src->reconnects,
+            src->reconnect_ns_max / 1e6);
+  }
+  for (int i = 0; i < n_sources; i++) {
+    source *src = &sources[i];
+    if (!src->events)
+      continue;
+    fprintf(stderr, "%s: %llu events", src->name,
+            (unsigned long long)src->events);
+    if (src->reads)
+      fprintf(stderr, " in %llu reads (%.1f/read)",
+              (unsigned long long)src->reads,
+              (double)src->events / src->reads);
+    fprintf(stderr, ", %llu resyncs\n", (unsigned long long)src->resyncs);
+  }
+  fprintf(stderr, "loop wakeups: %llu (%.1f/s)\n", (unsigned long long)wakeups,
+          wall_s > 0 ? wakeups / wall_s : 0.0);
+  fprintf(stderr, "syscalls: %llu, %.3f/report\n", (unsigned long long)syscalls,
+          reports ? (double)syscalls / reports : 0.0);
+  fprintf(stderr, "cpu time: %.0f us user+sys, %.3f us/report\n", cpu_us,
+          reports ? cpu_us / reports : 0.0);
+  fprintf(stderr, "context switches: %ld voluntary, %ld involuntary\n",
+          ru.ru_nvcsw, ru.ru_nivcsw);
+}
+
+typedef struct {
+  int w9013;
+  struct libevdev *w9013_evdev;
+  struct libevdev *ws8100_pen;
+  struct libevdev *cyttsp5;
+} devices;
+
+// Events masked with EVIOCSMASK are never queued for this client, and a
+// frame the mask leaves empty does not wake it either, so changes nothing
+// here forwards (pressure, contact size, scan codes) cost no wakeups.
+// Without codes the device is silenced, for the ones only grabbed. Kernels
+// before 4.4 lack the ioctl and keep delivering everything.
+void mask_evdev(struct libevdev *dev, unsigned int type,
+                const unsigned int *codes, size_t n_codes) {
+  unsigned long types = n_codes ? 1UL << type : 0;
+  unsigned long bits[KEY_CNT / (8 * sizeof(long)) + 1] = {0};
+  struct input_mask mask = {.type = EV_SYN,
+                            .codes_size = sizeof(types),
+                            .codes_ptr = (uintptr_t)&types};
+  int fd = libevdev_get_fd(dev);
+
+  // the EV_SYN mask selects types, EV_SYN itself always gets through
+  ioctl(fd, EVIOCSMASK, &mask);
+  if (!n_codes)
+    return;
+  for (size_t i = 0; i < n_codes; i++)
+    bits[codes[i] / (8 * sizeof(long))] |= 1UL << codes[i] % (8 * sizeof(long));
+  mask = (struct input_mask){
+      .type = type, .codes_size = sizeof(bits), .codes_ptr = (uintptr_t)bits};
+  ioctl(fd, EVIOCSMASK, &mask);
+}
+
+static const unsigned int ws8100_pen_codes[] = {
+    BTN_TOOL_RUBBER, KEY_MACRO1, BTN_TOOL_PEN, KEY_MACRO2,
+    BTN_STYLUS3,     KEY_SLEEP,  KEY_MACRO3};
+static const unsigned int cyttsp5_codes[] = {
+    ABS_MT_SLOT, ABS_MT_TRACKING_ID, ABS_MT_POSITION_X, ABS_MT_POSITION_Y};
+
+// forwarding the touchscreen reads it, --grab-touchscreen alone only holds it
+void mask_cyttsp5(struct libevdev *dev, bool forwarded) {
+  mask_evdev(dev, EV_ABS, cyttsp5_codes,
+             forwarded ? sizeof(cyttsp5_codes) / sizeof(cyttsp5_codes[0])
+                       : 0);
+}
+
+int open_devices(devices *d, const device_nodes *nodes, bool grab_cyttsp5,
+                 bool use_cyttsp5) {
+  d->w9013 = open_hidraw_node(nodes->w9013, "w9013 digitizer", W9013_VENDOR,
+                              W9013_PRODUCT);
+  if (d->w9013 < 0) {
+    fprintf(stderr, "Failed to find w9013 digitizer\n");
+    return -1;
+  }
+
+  if (open_evdev_node(nodes->w9013_evdev, W9013_NAME, &d->w9013_evdev) < 0) {
+    fprintf(stderr, "Failed to find w9013\n");
+    return -1;
+  }
+  if (libevdev_grab(d->w9013_evdev, LIBEVDEV_GRAB) < 0) {
+    fprintf(stderr, "Failed to grab w9013\n");
+    return -1;
+  }
+  mask_evdev(d->w9013_evdev, EV_SYN, NULL, 0);
+
+  if (open_evdev_node(nodes->ws8100_pen, WS8100_PEN_NAME, &d->ws8100_pen) <
+      0) {
+    fprintf(stderr, "Failed to find ws8100_pen\n");
+    return -1;
+  }
+  if (libevdev_grab(d->ws8100_pen, LIBEVDEV_GRAB) < 0) {
+    fprintf(stderr, "Failed to grab ws8100_pen\n");
+    return -1;
+  }
+  // event times are on the clock the pen reports are stamped with, button
+  // times are compared against pen ones when merging
+  if (libevdev_set_clock_id(d->ws8100_pen, CLOCK_MONOTONIC) < 0) {
+    fprintf(stderr, "Failed to set the ws8100_pen clock\n");
+    return -1;
+  }
+  mask_evdev(d->ws8100_pen, EV_KEY, ws8100_pen_codes,
+             sizeof(ws8100_pen_codes) / sizeof(ws8100_pen_codes[0]));
+
+  if (grab_cyttsp5) {
+    if (open_evdev_node(nodes->cyttsp5, CYTTSP5_NAME, &d->cyttsp5) < 0) {
+      fprintf(stderr, "Failed to find cyttsp5\n");
+      return -1;
     }
+    if (libevdev_grab(d->cyttsp5, LIBEVDEV_GRAB) < 0) {
+      fprintf(stderr, "Failed to grab cyttsp5\n");
+      return -1;
+    }
+    // the frame times are sent as Scan Time, and compared against pen ones
+    // for palm rejection
+    if (libevdev_set_clock_id(d->cyttsp5, CLOCK_MONOTONIC) < 0) {
+      fprintf(stderr, "Failed to set the cyttsp5 clock\n");
+      return -1;
+    }
+    mask_cyttsp5(d->cyttsp5, use_cyttsp5);
+  }
+  return 0;
+}
+
+void close_evdev(struct libevdev *dev) {
+  int fd;
+
+  if (!dev)
+    return;
+  fd = libevdev_get_fd(dev);
+  libevdev_grab(dev, LIBEVDEV_UNGRAB);
+  libevdev_free(dev);
+  close(fd);
+}
+
+// the kernel fails every ioctl on an evdev node whose device was removed
+bool evdev_gone(struct libevdev *dev) {
+  int version;
+
+  return ioctl(libevdev_get_fd(dev), EVIOCGVERSION, &version) < 0 &&
+         errno == ENODEV;
+}
+
+void close_devices(devices *d) {
+  close_evdev(d->cyttsp5);
+  close_evdev(d->ws8100_pen);
+  close_evdev(d->w9013_evdev);
+  if (d->w9013 >= 0)
+    close(d->w9013);
+}
+
+int evdev_fd(struct libevdev *dev) { return dev ? libevdev_get_fd(dev) : -1; }
+
+enum {
+  SRC_W9013,
+  SRC_WS8100_PEN,
+  SRC_CYTTSP5,
+  SRC_PEN_OUT,
+  SRC_TOUCH_OUT,
+  SRC_PEN_TIMER,
+  SRC_HOTPLUG,
+  SRC_SIGNAL,
+  N_SOURCES
+};
+
+_Static_assert(N_SOURCES <= METRICS_MAX_SOURCES, "metrics for every source");
+
+typedef struct {
+  devices *devs;
+  source *sources;
+  outputs *outs;
+  int epfd;
+  bool grab_cyttsp5;
+  bool reconnect; // wait for lost devices instead of exiting
+  uint64_t start_ns;
+  bool forwarding;
+  uint64_t loop_syscalls; // epoll_wait() or io_uring_enter()
+#ifdef HAVE_IO_URING
+  uring *ring; // NULL for the epoll loop
+  uint32_t uring_gen[N_SOURCES];
+#endif
+} forwarder;
+
+#ifdef HAVE_IO_URING
+
+// the epoll set's poll, and cancellations whose completion is not needed
+#define URING_EPOLL 0
+#define URING_IGNORE UINT64_MAX
+
+bool is_read_source(source *src) {
+  return src->handle == handle_hidraw_source ||
+         src->handle == handle_evdev_batch_source;
+}
+
+// names a source's poll on the ring; the generation moves on when the
+// source is detached, so the last completions of a poll on a device that
+// went away are not taken for its replacement's
+uint64_t uring_poll_id(forwarder *fw, source *src) {
+  int i = src - fw->sources;
+
+  return (uint64_t)fw->uring_gen[i] << 32 | (i + 1);
+}
+
+#endif
 
-    ioctl(fd, HIDIOCGRAWINFO, &hidinfo);
-    if (hidinfo.vendor == vid && hidinfo.product == pid) {
-      printf("Found %s at: %s\n", device, path);
-      return fd;
+// the input devices go to the ring when there is one, the rest to epoll
+int watch_source(forwarder *fw, source *src) {
+#ifdef HAVE_IO_URING
+  if (fw->ring && is_read_source(src))
+    return uring_prep_poll(fw->ring, src->fd, uring_poll_id(fw, src));
+#endif
+  return add_source(fw->epfd, src);
+}
+
+// lets the host see the pen leave, the buttons go up and the fingers lift
+// when the device behind a source disappears in the middle of a stroke
+void release_source(forwarder *fw, source *src) {
+  switch (src - fw->sources) {
+  case SRC_W9013:
+    pen_path_release(src->data, src->out, monotonic_ns());
+    break;
+  case SRC_WS8100_PEN: {
+    pen_buttons *buttons = src->data;
+
+    buttons->pending_bits = 0;
+    if (buttons->report[1]) {
+      buttons->report[1] = 0;
+      buttons->sent_bits = 0;
+      output_write(src->out, buttons->report, 2);
     }
+    break;
+  }
+  case SRC_CYTTSP5: {
+    slots *touches = src->data;
+    struct input_event syn = {.type = EV_SYN, .code = SYN_REPORT};
 
-    close(fd);
+    for (int i = 0; i < MAX_SLOTS; i++)
+      set_tracking_id(touches, i, -1);
+    src->handler(syn, touches, src->out);
+    break;
+  }
   }
+}
 
-  return -1;
+void detach_source(forwarder *fw, source *src) {
+  devices *d = fw->devs;
+
+  fprintf(stderr, "Lost %s, waiting for it to come back\n", src->name);
+  epoll_ctl(fw->epfd, EPOLL_CTL_DEL, src->fd, NULL);
+#ifdef HAVE_IO_URING
+  if (fw->ring && is_read_source(src)) {
+    uring_prep_poll_remove(fw->ring, uring_poll_id(fw, src), URING_IGNORE);
+    fw->uring_gen[src - fw->sources]++;
+  }
+#endif
+  release_source(fw, src);
+  switch (src - fw->sources) {
+  case SRC_W9013:
+    close(d->w9013);
+    d->w9013 = -1;
+    close_evdev(d->w9013_evdev);
+    d->w9013_evdev = NULL;
+    break;
+  case SRC_WS8100_PEN:
+    close_evdev(d->ws8100_pen);
+    d->ws8100_pen = NULL;
+    break;
+  case SRC_CYTTSP5:
+    close_evdev(d->cyttsp5);
+    d->cyttsp5 = NULL;
+    break;
+  }
+  src->fd = -1;
+  src->dev = NULL;
+  src->lost_ns = monotonic_ns();
 }
 
-int find_evdev_device(char *name, struct libevdev **out_dev) {
-  int fd;
-  char path[20];
-  struct libevdev *dev = NULL;
+void attach_source(forwarder *fw, source *src, int fd, struct libevdev *dev) {
+  uint64_t gap = monotonic_ns() - src->lost_ns;
 
-  for (int x = 0; x < 16; x++) {
-    sprintf(path, "/dev/input/event%d", x);
+  src->fd = fd;
+  src->dev = dev;
+  if (watch_source(fw, src) < 0)
+    return;
+  src->reconnects++;
+  src->reconnect_ns_sum += gap;
+  if (gap > src->reconnect_ns_max)
+    src->reconnect_ns_max = gap;
+  fprintf(stderr, "Reconnected %s after %.1f ms\n", src->name, gap / 1e6);
+}
 
-    if ((fd = open(path, O_RDWR | O_NONBLOCK)) == -1) {
-      continue;
+// looks for whichever devices went away, the gadget is left alone
+void reattach_devices(forwarder *fw) {
+  devices *d = fw->devs;
+  source *s = fw->sources;
+  device_nodes nodes;
+
+  // nodes only grabbed are not watched, a device coming back is when they
+  // are found gone and grabbed again
+  if (d->w9013_evdev && evdev_gone(d->w9013_evdev)) {
+    fprintf(stderr, "Lost w9013 evdev node, grabbing it again\n");
+    close_evdev(d->w9013_evdev);
+    d->w9013_evdev = NULL;
+  }
+  if (d->cyttsp5 && !s[SRC_CYTTSP5].handle && evdev_gone(d->cyttsp5)) {
+    fprintf(stderr, "Lost cyttsp5, grabbing it again\n");
+    close_evdev(d->cyttsp5);
+    d->cyttsp5 = NULL;
+  }
+
+  find_device_nodes(&nodes);
+  if (d->w9013 < 0) {
+    d->w9013 = open_hidraw_node(nodes.w9013, "w9013 digitizer", W9013_VENDOR,
+                                W9013_PRODUCT);
+    if (d->w9013 >= 0)
+      attach_source(fw, &s[SRC_W9013], d->w9013, NULL);
+  }
+  if (d->w9013 >= 0 && !d->w9013_evdev &&
+      open_evdev_node(nodes.w9013_evdev, W9013_NAME, &d->w9013_evdev) == 0) {
+    libevdev_grab(d->w9013_evdev, LIBEVDEV_GRAB);
+    mask_evdev(d->w9013_evdev, EV_SYN, NULL, 0);
+  }
+
+  if (!d->ws8100_pen &&
+      open_evdev_node(nodes.ws8100_pen, WS8100_PEN_NAME, &d->ws8100_pen) ==
+          0) {
+    libevdev_grab(d->ws8100_pen, LIBEVDEV_GRAB);
+    // as in open_devices(), a device on another clock is not forwarded;
+    // it stays lost until the next uevent tries again
+    if (libevdev_set_clock_id(d->ws8100_pen, CLOCK_MONOTONIC) < 0) {
+      fprintf(stderr, "Failed to set the ws8100_pen clock\n");
+      close_evdev(d->ws8100_pen);
+      d->ws8100_pen = NULL;
+    } else {
+      mask_evdev(d->ws8100_pen, EV_KEY, ws8100_pen_codes,
+                 sizeof(ws8100_pen_codes) / sizeof(ws8100_pen_codes[0]));
+      attach_source(fw, &s[SRC_WS8100_PEN], libevdev_get_fd(d->ws8100_pen),
+                    d->ws8100_pen);
+    }
+  }
+
+  if (fw->grab_cyttsp5 && !d->cyttsp5 &&
+      open_evdev_node(nodes.cyttsp5, CYTTSP5_NAME, &d->cyttsp5) == 0) {
+    libevdev_grab(d->cyttsp5, LIBEVDEV_GRAB);
+    if (libevdev_set_clock_id(d->cyttsp5, CLOCK_MONOTONIC) < 0) {
+      fprintf(stderr, "Failed to set the cyttsp5 clock\n");
+      close_evdev(d->cyttsp5);
+      d->cyttsp5 = NULL;
+    } else {
+      mask_cyttsp5(d->cyttsp5, s[SRC_CYTTSP5].handle != NULL);
+      if (s[SRC_CYTTSP5].handle)
+        attach_source(fw, &s[SRC_CYTTSP5], libevdev_get_fd(d->cyttsp5),
+                      d->cyttsp5);
     }
-    if (libevdev_new_from_fd(fd, &dev) < 0) {
-      libevdev_free(dev);
+  }
+}
+
+int open_uevent_socket(void) {
+  struct sockaddr_nl addr = {.nl_family = AF_NETLINK, .nl_groups = 1};
+  int fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                  NETLINK_KOBJECT_UEVENT);
+  // only an "add@..." uevent can bring a device back; everything else, the
+  // battery's periodic change events among them, is dropped in the kernel
+  // rather than waking the loop
+  struct sock_filter filter[] = {
+      BPF_STMT(BPF_LD | BPF_W | BPF_ABS, 0),
+      BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0x61646440 /* "add@" */, 0, 1),
+      BPF_STMT(BPF_RET | BPF_K, 0xffffffff),
+      BPF_STMT(BPF_RET | BPF_K, 0),
+  };
+  struct sock_fprog prog = {.len = sizeof(filter) / sizeof(filter[0]),
+                            .filter = filter};
+
+  if (fd >= 0)
+    setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog));
+  if (fd < 0 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    perror("Failed to listen for uevents, lost devices will not be "
+           "reconnected");
+    if (fd >= 0)
+      close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+int handle_hotplug_source(source *src) {
+  forwarder *fw = src->data;
+  char buf[4096];
+  ssize_t n;
+  bool added = false;
+
+  while ((n = recv(src->fd, buf, sizeof(buf) - 1, 0)) > 0) {
+    src->syscalls++;
+    buf[n] = '\0';
+    if (strncmp(buf, "add@", 4) != 0)
       continue;
-    };
-    if (strcmp(libevdev_get_name(dev), name) == 0) {
-      printf("Found %s at: %s\n", name, path);
-      *out_dev = dev;
-      return 0;
+    for (char *p = buf; p < buf + n; p += strlen(p) + 1) {
+      if (strcmp(p, "SUBSYSTEM=hidraw") == 0 ||
+          strcmp(p, "SUBSYSTEM=input") == 0)
+        added = true;
     }
+  }
+  src->syscalls++;
+  if (added)
+    reattach_devices(fw);
+  return 0;
+}
 
-    libevdev_free(dev);
+// books what a source callback returned; -1 when the loop has to stop
+int finish_source(forwarder *fw, source *src, int r) {
+  if (r == SOURCE_LOST && fw->reconnect && src - fw->sources <= SRC_CYTTSP5) {
+    detach_source(fw, src);
+    return 0;
+  }
+  if (r < 0) {
+    if (r == SOURCE_LOST)
+      fprintf(stderr, "Lost %s\n", src->name);
+    return -1;
   }
+  if (r > 0 && !fw->forwarding && src - fw->sources <= SRC_CYTTSP5) {
+    fw->forwarding = true;
+    fprintf(stderr, "First report forwarded %.1f ms after start\n",
+            (monotonic_ns() - fw->start_ns) / 1e6);
+  }
+  src->reports += r;
+  metrics_add(&src->metrics->reports, r);
+  return 0;
+}
 
-  return -1;
+int dispatch_epoll_events(forwarder *fw, struct epoll_event *events, int n) {
+  for (int i = 0; i < n; i++) {
+    source *src = events[i].data.ptr;
+    uint64_t writes = output_writes(fw->outs);
+    int r;
+
+    src->wakeups++;
+    metrics_add(&src->metrics->wakeups, 1);
+    if (events[i].events & (EPOLLERR | EPOLLHUP))
+      r = SOURCE_LOST;
+    else
+      r = src->handle(src);
+    src->syscalls += output_writes(fw->outs) - writes;
+    if (finish_source(fw, src, r) < 0)
+      return -1;
+  }
+  return 0;
 }
 
-int handle_ws8100_pen_events(struct input_event ev, void *data,
-                             pthread_mutex_t *out_mutex, int out_fd) {
-  unsigned char *buttons = data;
-  if (ev.type == EV_KEY) {
-    int bit = -1;
-    bool invert = false; // used for when double press event is passed between
-                         // tool down and up to reproduce it with one output
-                         // instead of two.
-                         // (see drivers/input/misc/ws8100-pen.c
-                         // of the kernel)
-    switch (ev.code) {
-    case BTN_TOOL_RUBBER: // button 1 press and release, except it is kept
-                          // pressed during double press
-      bit = 0;
-      break;
-    case KEY_MACRO1: // button 1 double press
-      bit = 0;
-      invert = true;
-      break;
-    case BTN_TOOL_PEN: // button 2 press and release, except it is kept pressed
-                       // during double press
-      bit = 1;
-      break;
-    case KEY_MACRO2: // button 2 double press
-      bit = 1;
-      invert = true;
-      break;
-    case BTN_STYLUS3: // button 3 short press
-      bit = 2;
-      break;
-    case KEY_SLEEP: // button 3 long press
-      bit = 3;
+// runs every source callback from a single thread until one of them fails
+// or a signal arrives; returns the number of epoll wakeups
+uint64_t run_event_loop(forwarder *fw) {
+  struct epoll_event events[8];
+  uint64_t wakeups = 0;
+
+  for (;;) {
+    int n = epoll_wait(fw->epfd, events, 8, -1);
+
+    fw->loop_syscalls++;
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      perror("Failed to poll for events");
       break;
-    case KEY_MACRO3: // button 3 double press
-      bit = 4;
+    }
+    wakeups++;
+    LATENCY_WAKE();
+    if (dispatch_epoll_events(fw, events, n) < 0 ||
+        output_send_batch(fw->outs) < 0)
+      return wakeups;
+  }
+  return wakeups;
+}
+
+#ifdef HAVE_IO_URING
+
+// The input devices are polled through io_uring, with multishot polls that
+// stay armed, so waiting costs no epoll_ctl() or re-arm and a report one
+// io_uring_enter() and the read() the handlers make themselves. Every
+// other source is left to the epoll set, whose fd is one more poll on the
+// ring. hidraw and evdev cannot take reads from io_uring without a kernel
+// worker thread, and f_hidg writes could not either: both stay plain
+// syscalls, in the loop's own thread.
+uint64_t run_uring_loop(forwarder *fw) {
+  uring *ring = fw->ring;
+  struct epoll_event events[8];
+  uint64_t wakeups = 0;
+
+  uring_prep_poll(ring, fw->epfd, URING_EPOLL);
+  for (;;) {
+    struct io_uring_cqe *cqe;
+
+    fw->loop_syscalls++;
+    if (uring_submit_and_wait(ring) < 0) {
+      if (errno == EINTR)
+        continue;
+      perror("Failed to wait for completions");
       break;
     }
+    wakeups++;
+    LATENCY_WAKE();
+    while ((cqe = uring_peek(ring))) {
+      uint64_t id = cqe->user_data, writes;
+      bool more = cqe->flags & IORING_CQE_F_MORE;
+      int res = cqe->res, r;
+      source *src;
+
+      uring_seen(ring);
+      if (id == URING_IGNORE)
+        continue;
+      if (id == URING_EPOLL) {
+        int n = epoll_wait(fw->epfd, events, 8, 0);
 
-    if (bit >= 0) {
-      if (ev.value ^ invert) {
-        buttons[1] |= 1 << bit;
-      } else {
-        buttons[1] &= ~(1 << bit);
+        fw->loop_syscalls++;
+        if (n > 0 && dispatch_epoll_events(fw, events, n) < 0)
+          return wakeups;
+        if (!more)
+          uring_prep_poll(ring, fw->epfd, URING_EPOLL);
+        continue;
       }
-      pthread_mutex_lock(out_mutex);
-      if (write(out_fd, buttons, 2) != 2 && errno != ESHUTDOWN) {
-        perror("Write failed");
-        pthread_mutex_unlock(out_mutex);
-        return -1;
+      src = &fw->sources[(uint32_t)id - 1];
+      if (id != uring_poll_id(fw, src))
+        continue;
+      if (res < 0) {
+        fprintf(stderr, "Failed to poll %s: %s\n", src->name, strerror(-res));
+        return wakeups;
       }
-      pthread_mutex_unlock(out_mutex);
+
+      writes = output_writes(fw->outs);
+      src->wakeups++;
+      metrics_add(&src->metrics->wakeups, 1);
+      if (res & (POLLERR | POLLHUP))
+        r = SOURCE_LOST;
+      else
+        r = src->handle(src);
+      src->syscalls += output_writes(fw->outs) - writes;
+      if (finish_source(fw, src, r) < 0)
+        return wakeups;
+      // a detached source has a new id, and is polled again once it is back
+      if (!more && id == uring_poll_id(fw, src))
+        uring_prep_poll(ring, src->fd, id);
     }
+    if (output_send_batch(fw->outs) < 0)
+      return wakeups;
   }
-  return 0;
+  return wakeups;
 }
 
-int handle_cyttsp_events(struct input_event ev, void *data,
-                         pthread_mutex_t *out_mutex, int out_fd) {
-  slots *touches = data;
-  if (ev.type == EV_ABS) {
-    switch (ev.code) {
-    case ABS_MT_SLOT:
-      touches->current = ev.value;
-      break;
-    case ABS_MT_TRACKING_ID:
-      touches->tid[touches->current] = ev.value;
-      break;
-    case ABS_MT_POSITION_X:
-      touches->x[touches->current] = ev.value;
-      break;
-    case ABS_MT_POSITION_Y:
-      touches->y[touches->current] = ev.value;
-      break;
-    }
-  } else if (ev.type == EV_SYN && ev.code == SYN_REPORT) {
-    bool active[MAX_SLOTS] = {0};
-    bool lifting[MAX_SLOTS] = {0};
-    uint8_t n_touches = 0;
-
-    for (int i = 0; i < MAX_SLOTS; i++) {
-      if (touches->tid[i] != -1) {
-        active[i] = true;
-        n_touches++;
-      } else if (touches->lifted[i] == false) {
-        lifting[i] = true;
-        n_touches++;
-      }
+#endif
+
+static const int trace_sources[N_TRACE_SOURCES] = {
+    [TRACE_W9013] = SRC_W9013,
+    [TRACE_WS8100_PEN] = SRC_WS8100_PEN,
+    [TRACE_CYTTSP5] = SRC_CYTTSP5,
+};
+
+// sleeps until due unless it has passed, returns how late it woke
+uint64_t wait_until(uint64_t due) {
+  uint64_t now = monotonic_ns();
+
+  if (now < due) {
+    struct timespec ts = {due / 1000000000, due % 1000000000};
+
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+    now = monotonic_ns();
+  }
+  return now > due ? now - due : 0;
+}
+
+#define REPLAY_DRAIN_MS 1000
+
+// feeds a recorded trace through the same handlers as live input, either as
+// fast as possible or paced by the recorded timestamps; paced, the records
+// are stamped with the time they are replayed at, as if read from the
+// devices, so the Scan Time a receiver on this machine sees is comparable
+// with its own clock
+int replay_trace(trace_reader *r, source *sources, outputs *outs,
+                 bool realtime, int sigfd) {
+  pen_path *pen = sources[SRC_W9013].data;
+  const trace_record *rec;
+  struct signalfd_siginfo si;
+  uint64_t start = monotonic_ns(), first = 0, records = 0;
+  uint64_t late_sum = 0, late_max = 0;
+  double elapsed;
+
+  while ((rec = trace_next(r))) {
+    source *src;
+    uint64_t t_ns;
+    int n;
+
+    if (rec->source >= N_TRACE_SOURCES)
+      continue;
+    src = &sources[trace_sources[rec->source]];
+    if (!src->handle) // not forwarded in this run
+      continue;
+    if (records == 0)
+      first = rec->time_ns;
+    t_ns = realtime ? start + (rec->time_ns - first) : rec->time_ns;
+
+    // resampler ticks fall between records, on the trace's clock
+    while (pen->resample.running &&
+           pen->resample.next_tick_ns <= t_ns) {
+      uint64_t tick = pen->resample.next_tick_ns;
+
+      pen->resample.next_tick_ns += pen->resample.period_ns;
+      n = pen_path_tick(pen, sources[SRC_W9013].out, tick,
+                        realtime ? wait_until(tick) : 0);
+      if (n < 0 || output_send_batch(outs) < 0)
+        return -1;
+      sources[SRC_W9013].reports += n;
+      metrics_add(&sources[SRC_W9013].metrics->reports, n);
     }
 
-    for (int i = 0; i < MAX_SLOTS; i++) {
-      if (!(active[i] || lifting[i]))
-        continue;
+    if (realtime) {
+      uint64_t late = wait_until(t_ns);
+
+      late_sum += late;
+      if (late > late_max)
+        late_max = late;
+    }
 
-      uint8_t report[9] = {0x01, (active[i] ? 0x01 : 0x00) | ((i & 0x0F) << 4)};
-      memcpy(&report[2], &touches->x[i], 2);
-      memcpy(&report[4], &touches->y[i], 2);
-      report[6] = n_touches;
-      uint16_t time = ev.time.tv_usec / 100 + ev.time.tv_sec * 10000;
-      memcpy(&report[7], &time, 2);
+    LATENCY_READ();
+    if (rec->source == TRACE_W9013) {
+      n = pen_path_forward(src->data, src->out, rec->data, rec->len, t_ns);
+    } else {
+      const trace_input_event *tev = (const trace_input_event *)rec->data;
+      struct input_event ev;
 
-      if (write(out_fd, report, 9) != 9 && errno != ESHUTDOWN) {
-        perror("Write failed");
+      if (rec->len != sizeof(*tev)) {
+        fprintf(stderr, "Malformed trace: a %s record of %u bytes\n",
+                src->name, rec->len);
         return -1;
       }
+      ev = (struct input_event){
+          .type = tev->type, .code = tev->code, .value = tev->value};
+      ev.time.tv_sec = t_ns / 1000000000;
+      ev.time.tv_usec = t_ns / 1000 % 1000000;
+      n = src->handler(ev, src->data, src->out);
+      metrics_add(&src->metrics->events, 1);
     }
+    if (n < 0 || output_send_batch(outs) < 0)
+      return -1;
+    src->reports += n;
+    metrics_add(&src->metrics->reports, n);
 
-    for (int i = 0; i < MAX_SLOTS; i++) {
-      touches->lifted[i] = touches->tid[i] == -1;
+    if ((++records & 255) == 0 && read(sigfd, &si, sizeof(si)) == sizeof(si)) {
+      if (si.ssi_signo != SIGUSR1)
+        break;
+      LATENCY_DUMP();
     }
   }
+  // nothing polls the outputs during a replay, a report still queued for
+  // a busy gadget would be lost with the process
+  if (output_drain(outs, REPLAY_DRAIN_MS) < 0)
+    return -1;
+
+  elapsed = (monotonic_ns() - start) / 1e9;
+  fprintf(stderr, "replayed %llu records in %.3f s (%.0f records/s)\n",
+          (unsigned long long)records, elapsed,
+          elapsed > 0 ? records / elapsed : 0.0);
+  if (realtime && records)
+    fprintf(stderr, "lateness: mean %.1f us, max %.1f us\n",
+            late_sum / 1e3 / records, late_max / 1e3);
   return 0;
 }
 
-volatile sig_atomic_t keepRunning = true;
-static int wakeup_pipe_write;
+#define PREFAULT_STACK (256 * 1024)
+
+// touches the stack the loop will grow into, so it is mapped (and with
+// mlockall, locked) before the first report instead of faulting during one
+__attribute__((noinline)) void prefault_stack(void) {
+  volatile unsigned char stack[PREFAULT_STACK];
 
-void intHandler(int dummy) {
-  keepRunning = false;
-  write(wakeup_pipe_write, "\0", 1);
+  for (size_t i = 0; i < sizeof(stack); i += 4096)
+    stack[i] = 0;
 }
 
-typedef int (*evdev_handler_fn)(struct input_event, void *data,
-                                pthread_mutex_t *mutex, int out_fd);
+// a SCHED_FIFO priority, 1 to 99
+int parse_rt_priority(const char *arg, int *priority) {
+  char *end;
+  long v = strtol(arg, &end, 10);
 
-typedef struct {
-  struct libevdev *dev;
-  int fd;
-  void *data;
-  pthread_mutex_t *out_mutex;
-  int out_fd;
-  int wakeup_r;
-  int wakeup_w;
-  evdev_handler_fn handler;
-} evdev_worker_args;
-
-void *evdev_worker(void *arg) {
-  evdev_worker_args *a = arg;
-  int evdev_rc;
-  struct pollfd fds[] = {
-      {.fd = a->fd, .events = POLLIN},
-      {.fd = a->wakeup_r, .events = POLLIN},
-  };
+  if (end == arg || *end || v < 1 || v > 99)
+    return -1;
+  *priority = v;
+  return 0;
+}
 
-  while (keepRunning) {
-    int r = poll(fds, 2, -1);
-    if (r < 0) {
-      if (errno == EINTR)
-        continue;
-      perror("Failed to poll for events");
-      break;
-    }
-    if (fds[0].revents & POLLIN) {
-      struct input_event ev;
-      do {
-        evdev_rc = libevdev_next_event(a->dev, LIBEVDEV_READ_FLAG_NORMAL, &ev);
-        if (evdev_rc == LIBEVDEV_READ_STATUS_SYNC) {
-          printf("dropped\n");
-          while (evdev_rc == LIBEVDEV_READ_STATUS_SYNC) {
-            evdev_rc =
-                libevdev_next_event(a->dev, LIBEVDEV_READ_FLAG_SYNC, &ev);
-            if (a->handler(ev, a->data, a->out_mutex, a->out_fd) < 0)
-              goto exit;
-          }
-          printf("re-synced\n");
-        } else if (evdev_rc == LIBEVDEV_READ_STATUS_SUCCESS) {
-          if (a->handler(ev, a->data, a->out_mutex, a->out_fd) < 0)
-            goto exit;
-        } else {
-          fprintf(stderr, "Failed to handle events: %s\n", strerror(-evdev_rc));
-          goto exit;
-        }
-      } while (libevdev_has_event_pending(a->dev));
+// a cpu the affinity mask can name
+int parse_cpu(const char *arg, int *cpu) {
+  char *end;
+  long v = strtol(arg, &end, 10);
+
+  if (end == arg || *end || v < 0 || v >= CPU_SETSIZE)
+    return -1;
+  *cpu = v;
+  return 0;
+}
+
+// The loop handles every source, so there is one priority for all of them.
+// Memory is locked and prefaulted so a report never waits on a page fault.
+int enter_realtime(int priority, int cpu) {
+  struct sched_param param = {.sched_priority = priority};
+
+  if (cpu >= 0) {
+    cpu_set_t set;
+
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (sched_setaffinity(0, sizeof(set), &set) < 0) {
+      perror("Failed to pin to cpu");
+      return -1;
     }
   }
-exit:
-  keepRunning = false;
-  write(a->wakeup_w, "\0", 1);
-  return NULL;
+  if (priority <= 0)
+    return 0;
+  if (mlockall(MCL_CURRENT | MCL_FUTURE) < 0) {
+    perror("Failed to lock memory");
+    return -1;
+  }
+  prefault_stack();
+  if (sched_setscheduler(0, SCHED_FIFO, &param) < 0) {
+    perror("Failed to switch to SCHED_FIFO");
+    return -1;
+  }
+  return 0;
+}
+
+bool have_device_nodes(const device_nodes *nodes, bool grab_cyttsp5) {
+  return nodes->w9013[0] && nodes->w9013_evdev[0] && nodes->ws8100_pen[0] &&
+         (!grab_cyttsp5 || nodes->cyttsp5[0]);
+}
+
+// Drivers that probe late (after a resume, or at boot before this is
+// started) are waited for here rather than by restarting the service. The
+// uevent socket is open before the first scan, so a device that appears in
+// between is not missed; sysfs is scanned again on every "add@" uevent.
+void wait_for_devices(device_nodes *nodes, int uevent_fd, bool grab_cyttsp5,
+                      uint64_t timeout_ns) {
+  uint64_t deadline = monotonic_ns() + timeout_ns;
+  char buf[4096];
+
+  find_device_nodes(nodes);
+  while (!have_device_nodes(nodes, grab_cyttsp5) && uevent_fd >= 0) {
+    struct pollfd pfd = {.fd = uevent_fd, .events = POLLIN};
+    uint64_t now = monotonic_ns();
+
+    if (now >= deadline)
+      break;
+    if (poll(&pfd, 1, (deadline - now + 999999) / 1000000) <= 0)
+      continue;
+    while (recv(uevent_fd, buf, sizeof(buf), 0) > 0)
+      ;
+    find_device_nodes(nodes);
+  }
 }
 
 int main(int argc, char *argv[]) {
-  int wakeup_pipe[2];
-  bool use_cyttsp5 = false, grab_cyttsp5 = false;
-  int w9013, out_fd, out_fd2, evdev_rc, ws8100_pen_fd, cyttsp5_fd;
-  unsigned char w9013_buffer[15];
-  ssize_t bytes = 0;
-  unsigned char buttons[2] = {1, 0};
-  slots *cyttsp5_touches;
-  usbg_context usb_ctx = {0};
-  struct libevdev *ws8100_pen, *cyttsp5, *w9013_evdev = NULL;
-  pthread_mutex_t out_mutex = PTHREAD_MUTEX_INITIALIZER;
-  pthread_t cyttsp5_thread;
-  pthread_t ws8100_pen_thread;
-  evdev_worker_args cyttsp5_args, ws8100_pen_args;
+  bool use_cyttsp5 = false, grab_cyttsp5 = false, show_stats = false;
+  bool replay_realtime = false, use_uring = false;
+  int touch_contacts = MAX_SLOTS;
+  uint64_t touch_keepalive_ns = 0, touch_debounce_ns = 0, wait_devices_ns = 0;
+  uint64_t outputs_ns, devices_ns;
+  device_nodes nodes;
+  int epfd = -1, sigfd = -1, uevent_fd = -1;
+  const char *record_path = NULL, *replay_path = NULL, *metrics_path = NULL;
+  static metrics counters = {.listen_fd = -1};
+#ifdef HAVE_IO_URING
+  uring ring = {.fd = -1};
+#endif
+  pen_path pen = {.timer_fd = -1};
+  pen_buttons buttons = {.report = {1, 0}};
+  slots *cyttsp5_touches = NULL;
+  bool palm_rejection = false;
+  pen_proximity proximity = {0};
+  outputs outs = {.pen.fd = -1, .touch.fd = -1};
+  output_config out_cfg = {.kind = OUTPUT_GADGET};
+  devices devs = {.w9013 = -1};
+  trace_writer *recorder = NULL;
+  trace_reader replay = {0};
+  source sources[N_SOURCES];
+  forwarder fw = {.devs = &devs,
+                  .sources = sources,
+                  .outs = &outs,
+                  .start_ns = monotonic_ns()};
+  sigset_t mask;
+  struct timespec start;
+  uint64_t wakeups = 0;
   uint16_t vendor = USBG_VENDOR;
   uint16_t product = USBG_PRODUCT;
+  source_fn evdev_reader = handle_evdev_batch_source;
+  int rt_priority = 0, rt_cpu = -1;
 
+  pen_transform_defaults(&pen.transform);
   for (int i = 1; i < argc; i++) {
     if (strcmp(argv[i], "--use-touchscreen") == 0) {
       use_cyttsp5 = true;
@@ -632,166 +1304,408 @@ int main(int argc, char *argv[]) {
       vendor = (uint16_t)strtoul(argv[++i], NULL, 16);
     } else if (strcmp(argv[i], "--product") == 0 && i + 1 < argc) {
       product = (uint16_t)strtoul(argv[++i], NULL, 16);
+    } else if (strcmp(argv[i], "--palm-rejection") == 0 && i + 1 < argc) {
+      palm_rejection = true;
+      proximity.holdoff_ns = strtod(argv[++i], NULL) * 1000000;
+    } else if (strcmp(argv[i], "--merge-buttons") == 0) {
+      buttons.merge = true;
+      pen.buttons = &buttons;
+    } else if (strcmp(argv[i], "--touch-hybrid") == 0) {
+      touch_contacts = TOUCH_HYBRID_CONTACTS;
+    } else if (strcmp(argv[i], "--touch-keepalive") == 0 && i + 1 < argc) {
+      touch_keepalive_ns = strtod(argv[++i], NULL) * 1000000;
+    } else if (strcmp(argv[i], "--wait-devices") == 0 && i + 1 < argc) {
+      wait_devices_ns = strtod(argv[++i], NULL) * 1e9;
+    } else if (strcmp(argv[i], "--touch-debounce") == 0 && i + 1 < argc) {
+      touch_debounce_ns = strtod(argv[++i], NULL) * 1000000;
+    } else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc &&
+               parse_output(argv[i + 1], &out_cfg) == 0) {
+      i++;
+    } else if (strcmp(argv[i], "--nonblock-output") == 0) {
+      out_cfg.nonblock = true;
+    } else if (strcmp(argv[i], "--evdev-reader") == 0 && i + 1 < argc &&
+               strcmp(argv[i + 1], "libevdev") == 0) {
+      evdev_reader = handle_evdev_source;
+      i++;
+    } else if (strcmp(argv[i], "--evdev-reader") == 0 && i + 1 < argc &&
+               strcmp(argv[i + 1], "batch") == 0) {
+      i++;
+    } else if (strcmp(argv[i], "--io-engine") == 0 && i + 1 < argc &&
+               (strcmp(argv[i + 1], "epoll") == 0 ||
+                strcmp(argv[i + 1], "uring") == 0)) {
+      use_uring = strcmp(argv[++i], "uring") == 0;
+    } else if (strcmp(argv[i], "--keep-gadget") == 0) {
+      out_cfg.keep_gadget = true;
+    } else if (strcmp(argv[i], "--pen-filter") == 0 && i + 1 < argc &&
+               pen_filter_parse(&pen.filter, argv[i + 1]) == 0) {
+      i++;
+    } else if (strcmp(argv[i], "--pen-resample") == 0 && i + 1 < argc &&
+               pen_resample_parse(&pen.resample, argv[i + 1]) == 0) {
+      i++;
+    } else if (strcmp(argv[i], "--hover-throttle") == 0 && i + 1 < argc &&
+               pen_throttle_parse(&pen.throttle, argv[i + 1]) == 0) {
+      i++;
+    } else if (strcmp(argv[i], "--rotate") == 0 && i + 1 < argc &&
+               pen_transform_parse_rotation(&pen.transform, argv[i + 1]) ==
+                   0) {
+      i++;
+    } else if (strcmp(argv[i], "--area") == 0 && i + 1 < argc &&
+               pen_transform_parse_area(&pen.transform, argv[i + 1]) == 0) {
+      i++;
+    } else if (strcmp(argv[i], "--pressure-curve") == 0 && i + 1 < argc &&
+               pen_transform_parse_pressure(&pen.transform, argv[i + 1]) ==
+                   0) {
+      i++;
+    } else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+      record_path = argv[++i];
+    } else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+      replay_path = argv[++i];
+    } else if (strcmp(argv[i], "--realtime") == 0) {
+      replay_realtime = true;
+    } else if (strcmp(argv[i], "--rt") == 0 && i + 1 < argc &&
+               parse_rt_priority(argv[i + 1], &rt_priority) == 0) {
+      i++;
+    } else if (strcmp(argv[i], "--cpu") == 0 && i + 1 < argc &&
+               parse_cpu(argv[i + 1], &rt_cpu) == 0) {
+      i++;
+    } else if (strcmp(argv[i], "--stats") == 0) {
+      show_stats = true;
+    } else if (strcmp(argv[i], "--metrics") == 0 && i + 1 < argc) {
+      metrics_path = argv[++i];
     } else {
       printf("grabs and forwards PineNote's stylus and (optionally) "
              "touchscreen input.\n");
       printf("Usage: %s [options]\n\n", argv[0]);
       printf("Options:\n"
              "  --use-touchscreen   grab and forward touchscreen input\n"
-             "  --grab-touchscreen  grab touchscreen input\n");
+             "  --grab-touchscreen  grab touchscreen input\n"
+             "  --palm-rejection <hold-off ms>\n"
+             "                      drop touches while the pen is in range "
+             "and for\n"
+             "                      the hold-off after it leaves\n"
+             "  --merge-buttons     send pen button changes in the next pen "
+             "report\n"
+             "                      while the pen is in range, not as "
+             "reports of\n"
+             "                      their own\n"
+             "  --touch-hybrid      split touch frames over single-contact "
+             "reports\n"
+             "  --touch-keepalive <ms>\n"
+             "                      only send touch contacts that changed, "
+             "and all of\n"
+             "                      them at this interval; stay under the "
+             "100 ms after\n"
+             "                      which hid-multitouch lifts a silent "
+             "contact\n"
+             "  --touch-debounce <ms>\n"
+             "                      with no finger down, only send a new "
+             "contact once\n"
+             "                      it has lasted this long\n"
+             "  --wait-devices <s>  wait this long for input devices that "
+             "are not\n"
+             "                      there yet, instead of failing at once\n"
+             "  --output <backend>  gadget (default), uhid, file:<prefix>, "
+             "which\n"
+             "                      overwrites <prefix>0 and <prefix>1, or\n"
+             "                      udp:<host>[:<port>] and "
+             "tcp:<host>[:<port>] to stream to\n"
+             "                      pinenote-net-receiver\n"
+             "  --nonblock-output   never wait for the host, coalesce pen "
+             "motion and\n"
+             "                      touch frames while it is not reading\n"
+             "  --evdev-reader <r>  batch (default) reads many events per "
+             "syscall,\n"
+             "                      libevdev goes through libevdev one event "
+             "at a time\n"
+             "  --io-engine <e>     epoll (default) or uring, which keeps "
+             "reads armed\n"
+             "                      on the input devices with io_uring; "
+             "falls back\n"
+             "                      to epoll where io_uring is not "
+             "available\n"
+             "  --keep-gadget       leave the usb gadget in place on exit, "
+             "so a restart\n"
+             "                      does not make the host re-enumerate it\n"
+             "  --pen-filter <min cutoff hz>,<beta>[,<prediction ms>]\n"
+             "                      smooth the pen with a one-euro filter, "
+             "\"bypass\"\n"
+             "                      to pass reports through (default)\n"
+             "  --pen-resample <hz> send the pen at a fixed rate, "
+             "interpolating between\n"
+             "                      reports; tip, range and button "
+             "changes go out\n"
+             "                      as they come\n"
+             "  --hover-throttle <hz>[,<dead-band>]\n"
+             "                      drop repeated pen reports, and while "
+             "the pen\n"
+             "                      hovers send at most this rate and "
+             "only moves\n"
+             "                      past the dead-band, in digitizer "
+             "units; tip,\n"
+             "                      button and tilt changes go out at "
+             "once\n"
+             "  --rotate <degrees>  turn the pen clockwise by 0, 90, 180 "
+             "or 270\n"
+             "  --area <x>,<y>,<width>,<height>\n"
+             "                      map the pen onto part of the screen, "
+             "in fractions\n"
+             "                      of its size\n"
+             "  --pressure-curve <gamma | in:out,...>\n"
+             "                      remap pressure with a gamma or a "
+             "piecewise linear\n"
+             "                      curve through points between 0 and 1\n"
+             "  --record <file>     save all raw input to a trace\n"
+             "  --replay <file>     forward a trace instead of the devices, "
+             "as fast as\n"
+             "                      possible\n"
+             "  --realtime          replay with the recorded timing\n"
+             "  --rt <priority>     run as SCHED_FIFO (1-99) with locked, "
+             "prefaulted memory\n"
+             "  --cpu <n>           pin to one cpu\n"
+             "  --stats             print per-source wakeups, reports and cpu "
+             "time on exit\n"
+             "  --metrics <path>    serve counters in the Prometheus text "
+             "format on a\n"
+             "                      unix socket\n");
       return -1;
     }
   }
 
-  if (initUSB(&usb_ctx, use_cyttsp5, vendor, product) < 0) {
-    fprintf(stderr, "Failed to init usb gadget");
-    goto cleanup_usb;
+  pen_transform_init(&pen.transform);
+
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGINT);
+  sigaddset(&mask, SIGTERM);
+  sigaddset(&mask, SIGUSR1);
+  sigprocmask(SIG_BLOCK, &mask, NULL);
+  sigfd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+  fw.epfd = epfd = epoll_create1(EPOLL_CLOEXEC);
+  fw.grab_cyttsp5 = grab_cyttsp5;
+  if (sigfd < 0 || epfd < 0) {
+    perror("Failed to set up event loop");
+    goto cleanup;
   }
 
-  out_fd = open("/dev/hidg0", O_WRONLY);
-  if (out_fd < 0) {
-    perror("Failed to open /dev/hidg0");
-    goto cleanup_usb;
+  out_cfg.use_touch = use_cyttsp5;
+  out_cfg.touch_contacts = touch_contacts;
+  out_cfg.vendor = vendor;
+  out_cfg.product = product;
+  if (open_outputs(&outs, &out_cfg) < 0)
+    goto cleanup;
+  outputs_ns = monotonic_ns();
+
+  if (!(cyttsp5_touches = calloc(1, sizeof(slots))))
+    goto cleanup;
+  for (int i = 0; i < MAX_SLOTS; i++) {
+    cyttsp5_touches->tid[i] = -1;
+  }
+  // until told otherwise, every slot may be down on the host
+  cyttsp5_touches->host_down = ALL_SLOTS;
+  cyttsp5_touches->contacts_per_report = touch_contacts;
+  cyttsp5_touches->keepalive_ns = touch_keepalive_ns;
+  cyttsp5_touches->debounce_ns = touch_debounce_ns;
+  if (palm_rejection) {
+    pen.proximity = &proximity;
+    cyttsp5_touches->palm_rejection = &proximity;
   }
 
-  if (use_cyttsp5) {
-    out_fd2 = open("/dev/hidg1", O_WRONLY);
-    if (out_fd2 < 0) {
-      perror("Failed to open /dev/hidg1");
-      goto cleanup_usb;
-    }
+  if (replay_path) {
+    if (trace_map(&replay, replay_path) < 0)
+      goto cleanup;
+  } else {
+    uevent_fd = open_uevent_socket();
+    wait_for_devices(&nodes, uevent_fd, grab_cyttsp5, wait_devices_ns);
+    if (open_devices(&devs, &nodes, grab_cyttsp5, use_cyttsp5) < 0)
+      goto cleanup;
   }
+  devices_ns = monotonic_ns();
+  // from main() on, loading the program and its libraries is not counted
+  fprintf(stderr, "Ready after %.1f ms (outputs %.1f ms, devices %.1f ms)\n",
+          (devices_ns - fw.start_ns) / 1e6, (outputs_ns - fw.start_ns) / 1e6,
+          (devices_ns - outputs_ns) / 1e6);
 
-  w9013 = find_hidraw_device("w9013 digitizer", W9013_VENDOR, W9013_PRODUCT);
-  if (w9013 < 0) {
-    fprintf(stderr, "Failed to find w9013 digitizer");
-    goto cleanup_out_fd;
+  if (record_path && !replay_path) {
+    if (!(recorder = malloc(sizeof(*recorder))) ||
+        trace_create(recorder, record_path) < 0) {
+      free(recorder);
+      recorder = NULL;
+      goto cleanup;
+    }
   }
 
-  evdev_rc = find_evdev_device(W9013_NAME, &w9013_evdev);
-  if (evdev_rc < 0) {
-    fprintf(stderr, "Failed to find w9013");
-    goto cleanup_w9013;
+  sources[SRC_W9013] = (source){.name = "w9013",
+                                .fd = devs.w9013,
+                                .handle = handle_hidraw_source,
+                                .data = &pen,
+                                .out = &outs.pen,
+                                .trace = recorder,
+                                .trace_source = TRACE_W9013};
+  sources[SRC_WS8100_PEN] = (source){.name = "ws8100_pen",
+                                     .fd = evdev_fd(devs.ws8100_pen),
+                                     .handle = evdev_reader,
+                                     .dev = devs.ws8100_pen,
+                                     .data = &buttons,
+                                     .out = &outs.pen,
+                                     .handler = handle_ws8100_pen_events,
+                                     .batch = ws8100_pen_batch,
+                                     .resync = ws8100_pen_resync,
+                                     .trace = recorder,
+                                     .trace_source = TRACE_WS8100_PEN};
+  sources[SRC_CYTTSP5] = (source){.name = "cyttsp5", .fd = -1};
+  if (use_cyttsp5) {
+    sources[SRC_CYTTSP5] = (source){.name = "cyttsp5",
+                                    .fd = evdev_fd(devs.cyttsp5),
+                                    .handle = evdev_reader,
+                                    .dev = devs.cyttsp5,
+                                    .data = cyttsp5_touches,
+                                    .out = &outs.touch,
+                                    .handler = handle_cyttsp_events,
+                                    .batch = cyttsp_batch,
+                                    .resync = cyttsp_resync,
+                                    .trace = recorder,
+                                    .trace_source = TRACE_CYTTSP5};
   }
-  evdev_rc = libevdev_grab(w9013_evdev, LIBEVDEV_GRAB);
-  if (evdev_rc < 0) {
-    fprintf(stderr, "Failed to grab w9013");
-    goto cleanup_w9013_evdev;
+  sources[SRC_PEN_OUT] = (source){.name = "pen_out", .fd = -1};
+  if (outs.pen.handle_events || outs.pen.queue)
+    sources[SRC_PEN_OUT] = (source){.name = "pen_out",
+                                    .fd = outs.pen.fd,
+                                    .handle = handle_output_source,
+                                    .data = &outs.pen};
+  sources[SRC_TOUCH_OUT] = (source){.name = "touch_out", .fd = -1};
+  if (outs.touch.handle_events || outs.touch.queue)
+    sources[SRC_TOUCH_OUT] = (source){.name = "touch_out",
+                                      .fd = outs.touch.fd,
+                                      .handle = handle_output_source,
+                                      .data = &outs.touch};
+  sources[SRC_PEN_TIMER] = (source){.name = "pen_timer", .fd = -1};
+  if (pen.resample.enabled && !replay_path) {
+    if ((pen.timer_fd = timerfd_create(CLOCK_MONOTONIC,
+                                       TFD_NONBLOCK | TFD_CLOEXEC)) < 0) {
+      perror("Failed to create resampler timer");
+      goto cleanup;
+    }
+    sources[SRC_PEN_TIMER] = (source){.name = "pen_timer",
+                                      .fd = pen.timer_fd,
+                                      .handle = handle_resample_source,
+                                      .data = &pen,
+                                      .out = &outs.pen};
   }
+  sources[SRC_HOTPLUG] = (source){.name = "hotplug", .fd = -1};
+  if ((fw.reconnect = uevent_fd >= 0))
+    sources[SRC_HOTPLUG] = (source){.name = "hotplug",
+                                    .fd = uevent_fd,
+                                    .handle = handle_hotplug_source,
+                                    .data = &fw};
+  sources[SRC_SIGNAL] = (source){
+      .name = "signal", .fd = sigfd, .handle = handle_signal_source};
 
-  evdev_rc = find_evdev_device(WS8100_PEN_NAME, &ws8100_pen);
-  if (evdev_rc < 0) {
-    fprintf(stderr, "Failed to find ws8100_pen");
-    goto cleanup_w9013_evdev;
+  for (int i = 0; i < N_SOURCES; i++) {
+    sources[i].metrics = &counters.sources[i];
+    if (i != SRC_SIGNAL && sources[i].handle)
+      counters.source_names[i] = sources[i].name;
   }
-  ws8100_pen_fd = libevdev_get_fd(ws8100_pen);
-  evdev_rc = libevdev_grab(ws8100_pen, LIBEVDEV_GRAB);
-  if (evdev_rc < 0) {
-    fprintf(stderr, "Failed to grab ws8100_pen");
-    goto cleanup_ws8100;
+  outs.pen.metrics = &counters.outputs[0];
+  counters.output_names[0] = "pen";
+  if (use_cyttsp5) {
+    outs.touch.metrics = &counters.outputs[1];
+    counters.output_names[1] = "touch";
   }
+  // started before enter_realtime(), so the thread keeps the normal
+  // scheduling class and runs on any cpu
+  if (metrics_path && metrics_serve(&counters, metrics_path) < 0)
+    goto cleanup;
 
-  if (grab_cyttsp5) {
-    if (!(cyttsp5_touches = calloc(1, sizeof(slots))))
-      goto cleanup_ws8100;
-    for (int i = 0; i < MAX_SLOTS; i++) {
-      cyttsp5_touches->tid[i] = -1;
-    }
-    evdev_rc = find_evdev_device(CYTTSP5_NAME, &cyttsp5);
-    if (evdev_rc < 0) {
-      fprintf(stderr, "Failed to find cyttsp5");
-      free(cyttsp5_touches);
-      goto cleanup_ws8100;
-    }
-    cyttsp5_fd = libevdev_get_fd(cyttsp5);
-    evdev_rc = libevdev_grab(cyttsp5, LIBEVDEV_GRAB);
-    if (evdev_rc < 0) {
-      fprintf(stderr, "Failed to grab cyttsp5");
-      goto cleanup_all;
-    }
+  if (use_uring && !replay_path) {
+#ifdef HAVE_IO_URING
+    if (uring_init(&ring, 16) < 0)
+      fprintf(stderr, "io_uring not available (%s), using epoll\n",
+              strerror(errno));
+    else
+      fw.ring = &ring;
+#else
+    fprintf(stderr, "io_uring not built in, using epoll\n");
+#endif
   }
 
-  pipe(wakeup_pipe);
-  wakeup_pipe_write = wakeup_pipe[1];
-  signal(SIGINT, intHandler);
+  for (int i = 0; i < N_SOURCES; i++) {
+    if (sources[i].fd < 0)
+      continue;
+    if (sources[i].handle == handle_output_source) {
+      if (output_watch(sources[i].data, epfd, &sources[i]) < 0)
+        goto cleanup;
+    } else if (watch_source(&fw, &sources[i]) < 0) {
+      goto cleanup;
+    }
+  }
 
-  if (use_cyttsp5) {
-    cyttsp5_args = (evdev_worker_args){.dev = cyttsp5,
-                                       .fd = cyttsp5_fd,
-                                       .data = cyttsp5_touches,
-                                       .out_mutex = &out_mutex,
-                                       .out_fd = out_fd2,
-                                       .wakeup_r = wakeup_pipe[0],
-                                       .wakeup_w = wakeup_pipe[1],
-                                       .handler = handle_cyttsp_events};
-    pthread_create(&cyttsp5_thread, NULL, evdev_worker, &cyttsp5_args);
-  }
-
-  ws8100_pen_args = (evdev_worker_args){.dev = ws8100_pen,
-                                        .fd = ws8100_pen_fd,
-                                        .data = buttons,
-                                        .out_mutex = &out_mutex,
-                                        .out_fd = out_fd,
-                                        .wakeup_r = wakeup_pipe[0],
-                                        .wakeup_w = wakeup_pipe[1],
-                                        .handler = handle_ws8100_pen_events};
-  pthread_create(&ws8100_pen_thread, NULL, evdev_worker, &ws8100_pen_args);
-
-  struct pollfd fds[] = {
-      {.fd = w9013, .events = POLLIN},
-      {.fd = wakeup_pipe[0], .events = POLLIN},
-  };
+  if (enter_realtime(rt_priority, rt_cpu) < 0)
+    goto cleanup;
 
-  while (keepRunning) {
-    int r = poll(fds, 2, -1);
-    if (r < 0) {
-      if (errno == EINTR)
-        continue;
-      perror("Failed to poll for events");
-      break;
-    }
-    if (fds[0].revents & POLLIN) {
-      while ((bytes = read(w9013, w9013_buffer, sizeof(w9013_buffer))) > 0) {
-        pthread_mutex_lock(&out_mutex);
-        if (write(out_fd, w9013_buffer, bytes) != bytes && errno != ESHUTDOWN) {
-          perror("Write failed");
-          pthread_mutex_unlock(&out_mutex);
-          goto exit;
-        }
-        pthread_mutex_unlock(&out_mutex);
-      }
-      if (bytes < 0 && errno != EAGAIN) {
-        perror("Read failed");
-        goto exit;
-      }
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  if (replay_path)
+    replay_trace(&replay, sources, &outs, replay_realtime, sigfd);
+#ifdef HAVE_IO_URING
+  else if (fw.ring)
+    wakeups = run_uring_loop(&fw);
+#endif
+  else
+    wakeups = run_event_loop(&fw);
+  // the host keeps the device, leave it with the pen out of range and no
+  // fingers down
+  if (out_cfg.keep_gadget) {
+    for (int i = SRC_W9013; i <= SRC_CYTTSP5; i++) {
+      if (sources[i].fd >= 0 && sources[i].handle)
+        release_source(&fw, &sources[i]);
     }
   }
-exit:
-  keepRunning = 0;
-  write(wakeup_pipe[1], "\0", 1);
-  if (use_cyttsp5) {
-    pthread_join(cyttsp5_thread, NULL);
+  if (show_stats) {
+    print_stats(sources, SRC_SIGNAL, wakeups, fw.loop_syscalls, &start);
+    print_output_stats(&outs);
+    pen_filter_print_stats(&pen.filter, stderr);
+    pen_resample_print_stats(&pen.resample, stderr);
+    pen_throttle_print_stats(&pen.throttle, stderr);
+    pen_buttons_print_stats(&buttons, stderr);
+    if (palm_rejection && cyttsp5_touches->frames)
+      fprintf(stderr,
+              "palm rejection: %llu of %llu touch frames suppressed "
+              "(%.1f%%)\n",
+              (unsigned long long)cyttsp5_touches->suppressed,
+              (unsigned long long)cyttsp5_touches->frames,
+              100.0 * cyttsp5_touches->suppressed / cyttsp5_touches->frames);
+    if (cyttsp5_touches->frames)
+      fprintf(stderr,
+              "touch: %llu frames, %llu contacts sent, %llu unchanged "
+              "skipped, %llu frames debounced\n",
+              (unsigned long long)cyttsp5_touches->frames,
+              (unsigned long long)cyttsp5_touches->contacts_sent,
+              (unsigned long long)cyttsp5_touches->contacts_skipped,
+              (unsigned long long)cyttsp5_touches->debounced);
   }
-  pthread_join(ws8100_pen_thread, NULL);
-cleanup_all:
-  if (grab_cyttsp5) {
-    libevdev_grab(cyttsp5, LIBEVDEV_UNGRAB);
-    libevdev_free(cyttsp5);
-    close(cyttsp5_fd);
-    free(cyttsp5_touches);
-  }
-cleanup_ws8100:
-  libevdev_grab(ws8100_pen, LIBEVDEV_UNGRAB);
-  libevdev_free(ws8100_pen);
-  close(ws8100_pen_fd);
-cleanup_w9013_evdev:
-  libevdev_grab(w9013_evdev, LIBEVDEV_UNGRAB);
-  libevdev_free(w9013_evdev);
-cleanup_w9013:
-  close(w9013);
-cleanup_out_fd:
-  close(out_fd);
-cleanup_usb:
-  cleanupUSB(&usb_ctx);
+  LATENCY_DUMP();
+
+cleanup:
+  metrics_stop(&counters);
+#ifdef HAVE_IO_URING
+  // first, the armed polls keep the devices open, and grabbed, past
+  // close_devices()
+  uring_free(&ring);
+#endif
+  if (recorder) {
+    trace_close(recorder);
+    free(recorder);
+  }
+  if (replay.map)
+    trace_unmap(&replay);
+  close_devices(&devs);
+  close_outputs(&outs);
+  free(cyttsp5_touches);
+  if (epfd >= 0)
+    close(epfd);
+  if (sigfd >= 0)
+    close(sigfd);
+  if (uevent_fd >= 0)
+    close(uevent_fd);
+  if (pen.timer_fd >= 0)
+    close(pen.timer_fd);
   return 0;
 }
@@ -0,0 +1,200 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+#include "metrics.h"
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+typedef struct {
+  char data[8192];
+  size_t used;
+} text;
+
+static void append(text *t, const char *fmt, ...) {
+  va_list ap;
+  int n;
+
+  va_start(ap, fmt);
+  n = vsnprintf(t->data + t->used, sizeof(t->data) - t->used, fmt, ap);
+  va_end(ap);
+  if (n > 0)
+    t->used += (size_t)n < sizeof(t->data) - t->used
+                   ? (size_t)n
+                   : sizeof(t->data) - t->used - 1;
+}
+
+static const struct {
+  const char *name;
+  const char *help;
+  size_t offset;
+} source_counters[] = {
+    {"pinenote_source_wakeups_total",
+     "Times the event loop woke up for the source.",
+     offsetof(metrics_source, wakeups)},
+    {"pinenote_source_reports_total", "Reports written for the source.",
+     offsetof(metrics_source, reports)},
+    {"pinenote_source_events_total", "Input events read from the source.",
+     offsetof(metrics_source, events)},
+    {"pinenote_source_resyncs_total",
+     "Resyncs after the kernel dropped events (SYN_DROPPED).",
+     offsetof(metrics_source, resyncs)},
+};
+
+static const struct {
+  const char *name;
+  const char *help;
+  size_t offset;
+} output_counters[] = {
+    {"pinenote_output_writes_total", "Reports written to the output.",
+     offsetof(metrics_output, writes)},
+    {"pinenote_output_bytes_total", "Bytes written to the output.",
+     offsetof(metrics_output, bytes)},
+    {"pinenote_output_shutdown_total",
+     "Writes that failed with ESHUTDOWN, the host was not connected.",
+     offsetof(metrics_output, shutdown)},
+    {"pinenote_output_transitions_dropped_total",
+     "State changes lost from a full output queue while the host was not "
+     "reading.",
+     offsetof(metrics_output, transitions_dropped)},
+};
+
+static uint64_t load(const void *base, size_t offset) {
+  return atomic_load_explicit(
+      (_Atomic uint64_t *)((const char *)base + offset), memory_order_relaxed);
+}
+
+static void format_metrics(metrics *m, text *t) {
+  for (size_t c = 0; c < sizeof(source_counters) / sizeof(source_counters[0]);
+       c++) {
+    append(t, "# HELP %s %s\n# TYPE %s counter\n", source_counters[c].name,
+           source_counters[c].help, source_counters[c].name);
+    for (int i = 0; i < METRICS_MAX_SOURCES; i++) {
+      if (m->source_names[i])
+        append(t, "%s{source=\"%s\"} %llu\n", source_counters[c].name,
+               m->source_names[i],
+               (unsigned long long)load(&m->sources[i],
+                                        source_counters[c].offset));
+    }
+  }
+  for (size_t c = 0; c < sizeof(output_counters) / sizeof(output_counters[0]);
+       c++) {
+    append(t, "# HELP %s %s\n# TYPE %s counter\n", output_counters[c].name,
+           output_counters[c].help, output_counters[c].name);
+    for (int i = 0; i < 2; i++) {
+      if (m->output_names[i])
+        append(t, "%s{output=\"%s\"} %llu\n", output_counters[c].name,
+               m->output_names[i],
+               (unsigned long long)load(&m->outputs[i],
+                                        output_counters[c].offset));
+    }
+  }
+}
+
+static void write_all(int fd, const char *buf, size_t len) {
+  while (len) {
+    ssize_t n = write(fd, buf, len);
+
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return;
+    buf += n;
+    len -= n;
+  }
+}
+
+// HTTP for scrapers (curl --unix-socket, or a Prometheus behind a socket
+// proxy), the bare text for anything that connects and only reads
+static void answer(metrics *m, int fd) {
+  static text body;
+  struct pollfd pfd = {.fd = fd, .events = POLLIN};
+  char request[1024], header[128];
+  ssize_t n = 0;
+  int len;
+
+  if (poll(&pfd, 1, 100) > 0)
+    n = read(fd, request, sizeof(request) - 1);
+  body.used = 0;
+  format_metrics(m, &body);
+  if (n >= 4 && memcmp(request, "GET ", 4) == 0) {
+    len = snprintf(header, sizeof(header),
+                   "HTTP/1.0 200 OK\r\n"
+                   "Content-Type: text/plain; version=0.0.4\r\n"
+                   "Content-Length: %zu\r\n\r\n",
+                   body.used);
+    write_all(fd, header, len);
+  }
+  write_all(fd, body.data, body.used);
+}
+
+static void *serve(void *arg) {
+  metrics *m = arg;
+  int fd;
+
+  // closing the listening socket from metrics_stop() ends the loop
+  while ((fd = accept(m->listen_fd, NULL, NULL)) >= 0 || errno == EINTR ||
+         errno == ECONNABORTED) {
+    if (fd < 0)
+      continue;
+    answer(m, fd);
+    close(fd);
+  }
+  return NULL;
+}
+
+int metrics_serve(metrics *m, const char *path) {
+  struct sockaddr_un addr = {.sun_family = AF_UNIX};
+  sigset_t all, old;
+  int rc;
+
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "Metrics socket path too long: %s\n", path);
+    return -1;
+  }
+  strcpy(addr.sun_path, path);
+  m->listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  // a socket left behind by a previous run would make bind() fail
+  unlink(path);
+  if (m->listen_fd < 0 ||
+      bind(m->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+      listen(m->listen_fd, 4) < 0) {
+    perror("Failed to listen for metrics scrapes");
+    if (m->listen_fd >= 0)
+      close(m->listen_fd);
+    m->listen_fd = -1;
+    return -1;
+  }
+  m->path = path;
+
+  // signals stay with the main thread's signalfd
+  sigfillset(&all);
+  pthread_sigmask(SIG_SETMASK, &all, &old);
+  rc = pthread_create(&m->thread, NULL, serve, m);
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+  if (rc) {
+    errno = rc;
+    perror("Failed to start metrics thread");
+    close(m->listen_fd);
+    unlink(path);
+    m->listen_fd = -1;
+    return -1;
+  }
+  return 0;
+}
+
+void metrics_stop(metrics *m) {
+  if (m->listen_fd < 0)
+    return;
+  // wakes the thread from accept()
+  shutdown(m->listen_fd, SHUT_RDWR);
+  pthread_join(m->thread, NULL);
+  close(m->listen_fd);
+  unlink(m->path);
+  m->listen_fd = -1;
+}
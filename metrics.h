@@ -0,0 +1,52 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+#ifndef PINENOTE_METRICS_H
+#define PINENOTE_METRICS_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+
+// Counters served in the Prometheus text format on a Unix socket with
+// --metrics. The event loop bumps them with relaxed atomics and a thread of
+// its own answers scrapes, so serving never runs on the forwarding path.
+// Every source and output has its counters on a cache line of its own:
+// a scrape only reads the lines, and writes to one source's counters never
+// invalidate another's.
+
+#define METRICS_LINE 64
+#define METRICS_MAX_SOURCES 8
+
+typedef struct {
+  _Alignas(METRICS_LINE) _Atomic uint64_t wakeups;
+  _Atomic uint64_t reports;
+  _Atomic uint64_t events;
+  _Atomic uint64_t resyncs; // SYN_DROPPED, the kernel's buffer overflowed
+} metrics_source;
+
+typedef struct {
+  _Alignas(METRICS_LINE) _Atomic uint64_t writes;
+  _Atomic uint64_t bytes;
+  _Atomic uint64_t shutdown; // writes the host was not there to take
+  _Atomic uint64_t transitions_dropped; // lost from a full output queue
+} metrics_output;
+
+typedef struct {
+  metrics_source sources[METRICS_MAX_SOURCES];
+  metrics_output outputs[2];
+  // set before serving starts, NULL for sources that are not exported
+  const char *source_names[METRICS_MAX_SOURCES];
+  const char *output_names[2];
+  const char *path;
+  int listen_fd;
+  pthread_t thread;
+} metrics;
+
+static inline void metrics_add(_Atomic uint64_t *counter, uint64_t n) {
+  atomic_fetch_add_explicit(counter, n, memory_order_relaxed);
+}
+
+// listens on path and starts the serving thread
+int metrics_serve(metrics *m, const char *path);
+void metrics_stop(metrics *m);
+
+#endif
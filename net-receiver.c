@@ -0,0 +1,340 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+// Receives the reports pinenote-usb-tablet streams with --output udp:/tcp:
+// and writes them to local uhid devices (or report files), for hosts that
+// cannot take the PineNote as a usb device.
+#define _GNU_SOURCE
+#include "descriptors.h"
+#include "latency.h"
+#include "net.h"
+#include "output.h"
+#include "trace.h"
+#include <endian.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+typedef struct {
+  output_config cfg;
+  outputs outs;
+  bool opened;
+  int epfd;
+  bool have_seq;
+  uint32_t next_seq;
+  uint64_t packets;
+  uint64_t reports;
+  uint64_t lost;
+  uint64_t malformed;
+  uint64_t first_ns;
+  uint64_t last_ns;
+  latency_histogram latency; // sender's write to our write, same host only
+  // the reports' Scan Time to our write, per channel, same host only
+  latency_histogram input_latency[2];
+} receiver;
+
+// the touch descriptor depends on the sender's contact count, so the
+// devices are created when the first packet says what it is
+static int open_receiver_outputs(receiver *rx, int touch_contacts) {
+  output *outs[] = {&rx->outs.pen, &rx->outs.touch};
+  struct epoll_event ev = {.events = EPOLLIN};
+
+  rx->cfg.use_touch = touch_contacts > 0;
+  rx->cfg.touch_contacts = touch_contacts > 0 ? touch_contacts : MAX_SLOTS;
+  if (open_outputs(&rx->outs, &rx->cfg) < 0)
+    return -1;
+  rx->opened = true;
+  for (int i = 0; i < 2; i++) {
+    if (outs[i]->fd < 0 || !outs[i]->handle_events)
+      continue;
+    ev.data.fd = outs[i]->fd;
+    if (epoll_ctl(rx->epfd, EPOLL_CTL_ADD, outs[i]->fd, &ev) < 0) {
+      perror("Failed to watch output");
+      return -1;
+    }
+  }
+  return 0;
+}
+
+// the time the report was read from the device, as the forwarder stamped it
+static bool get_scan_time(const net_report *r, uint16_t *scan_time) {
+  if (r->channel == NET_PEN && r->len == PEN_REPORT_LEN &&
+      r->data[0] == PEN_REPORT_ID)
+    memcpy(scan_time, &r->data[PEN_SCAN_TIME], 2);
+  else if (r->channel == NET_TOUCH && r->len >= 3)
+    memcpy(scan_time, &r->data[r->len - 2], 2);
+  else
+    return false;
+  *scan_time = le16toh(*scan_time);
+  return true;
+}
+
+// The Scan Time wraps every 6.5 s, far longer than any report takes to get
+// here, so the distance to now is taken modulo the wrap. It is only good
+// to the field's 100 us: the result is up to that much too long.
+static uint64_t since_scan_time(uint16_t scan_time, uint64_t now_ns) {
+  return (uint16_t)(HID_SCAN_TIME(now_ns) - scan_time) * 100000ULL +
+         now_ns % 100000;
+}
+
+static int handle_packet(receiver *rx, const unsigned char *buf, size_t len) {
+  const net_header *h = (const net_header *)buf;
+  size_t off = sizeof(*h);
+  uint32_t seq;
+
+  // the contact count sizes the touch descriptor, the only one of the
+  // sender's values that reaches a fixed buffer
+  if (len < sizeof(*h) || le16toh(h->magic) != NET_MAGIC ||
+      h->version != NET_VERSION || le16toh(h->size) != len ||
+      h->touch_contacts > MAX_SLOTS) {
+    rx->malformed++;
+    return 0;
+  }
+  seq = le32toh(h->seq);
+  if (rx->have_seq && (int32_t)(seq - rx->next_seq) > 0)
+    rx->lost += seq - rx->next_seq;
+  rx->have_seq = true;
+  rx->next_seq = seq + 1;
+  if (!rx->opened && open_receiver_outputs(rx, h->touch_contacts) < 0)
+    return -1;
+
+  for (int i = 0; i < h->count; i++) {
+    const net_report *r = (const net_report *)(buf + off);
+    output *out;
+    uint16_t scan_time;
+    uint64_t now;
+
+    // nothing of the report is read before it is known to be in the packet
+    if (off + sizeof(*r) > len || off + sizeof(*r) + r->len > len) {
+      rx->malformed++;
+      break;
+    }
+    out = r->channel == NET_TOUCH ? &rx->outs.touch : &rx->outs.pen;
+    if (out->write && output_write(out, r->data, r->len) != r->len &&
+        errno != ESHUTDOWN) {
+      perror("Write failed");
+      return -1;
+    }
+    now = monotonic_ns();
+    latency_histogram_add(&rx->latency, now - le64toh(r->time_ns));
+    if (get_scan_time(r, &scan_time))
+      latency_histogram_add(&rx->input_latency[r->channel == NET_TOUCH],
+                            since_scan_time(scan_time, now));
+    rx->reports++;
+    off += sizeof(*r) + r->len;
+  }
+  rx->last_ns = monotonic_ns();
+  if (!rx->packets++)
+    rx->first_ns = rx->last_ns;
+  return 0;
+}
+
+// packets follow each other on the stream, each one says how long it is
+static int handle_stream(receiver *rx, int fd, unsigned char *buf,
+                         size_t *used) {
+  ssize_t n = recv(fd, buf + *used, 2 * NET_MAX_PACKET - *used, 0);
+  size_t off = 0;
+
+  if (n <= 0)
+    return -1;
+  *used += n;
+  while (*used - off >= sizeof(net_header)) {
+    size_t size = le16toh(((const net_header *)(buf + off))->size);
+
+    if (size < sizeof(net_header) || size > NET_MAX_PACKET) {
+      rx->malformed++;
+      return -1;
+    }
+    if (*used - off < size)
+      break;
+    if (handle_packet(rx, buf + off, size) < 0)
+      return -1;
+    off += size;
+  }
+  memmove(buf, buf + off, *used - off);
+  *used -= off;
+  return 0;
+}
+
+static void print_receiver_stats(receiver *rx) {
+  static const char *channels[] = {"pen", "touch"};
+  double secs = (rx->last_ns - rx->first_ns) / 1e9;
+
+  fprintf(stderr,
+          "received %llu packets, %llu reports (%.0f reports/s), %llu lost, "
+          "%llu malformed\n",
+          (unsigned long long)rx->packets, (unsigned long long)rx->reports,
+          secs > 0 ? rx->reports / secs : 0.0, (unsigned long long)rx->lost,
+          (unsigned long long)rx->malformed);
+  if (rx->reports)
+    fprintf(stderr,
+            "latency: p50 %.1f us, p99 %.1f us, p99.9 %.1f us, max %.1f us\n",
+            latency_histogram_percentile(&rx->latency, 0.5) / 1e3,
+            latency_histogram_percentile(&rx->latency, 0.99) / 1e3,
+            latency_histogram_percentile(&rx->latency, 0.999) / 1e3,
+            atomic_load(&rx->latency.max) / 1e3);
+  // the spread is what a host timing reports by their arrival, rather than
+  // by their Scan Time, would get wrong
+  for (int c = 0; c < 2; c++) {
+    latency_histogram *h = &rx->input_latency[c];
+    uint64_t p50, p99;
+
+    if (!atomic_load(&h->total))
+      continue;
+    p50 = latency_histogram_percentile(h, 0.5);
+    p99 = latency_histogram_percentile(h, 0.99);
+    fprintf(stderr,
+            "%s scan time to write: p50 %.1f us, p99 %.1f us, max %.1f us, "
+            "jitter (p99 - p50) %.1f us\n",
+            channels[c], p50 / 1e3, p99 / 1e3, atomic_load(&h->max) / 1e3,
+            (p99 - p50) / 1e3);
+  }
+}
+
+int main(int argc, char *argv[]) {
+  static receiver rx = {.cfg = {.kind = OUTPUT_UHID,
+                                .vendor = USBG_VENDOR,
+                                .product = USBG_PRODUCT},
+                        .outs = {.pen.fd = -1, .touch.fd = -1}};
+  static unsigned char buf[2 * NET_MAX_PACKET];
+  struct sockaddr_in addr = {.sin_family = AF_INET,
+                             .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+                             .sin_port = htons(NET_DEFAULT_PORT)};
+  struct epoll_event ev = {.events = EPOLLIN};
+  bool stream = false, show_stats = false;
+  int sock = -1, client = -1, sigfd = -1, one = 1, rc = -1;
+  size_t used = 0;
+  sigset_t mask;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--tcp") == 0) {
+      stream = true;
+    } else if (strcmp(argv[i], "--listen-all") == 0) {
+      addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    } else if (strcmp(argv[i], "--port") == 0 && i + 1 < argc) {
+      addr.sin_port = htons(strtol(argv[++i], NULL, 10));
+    } else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc &&
+               parse_output(argv[i + 1], &rx.cfg) == 0 &&
+               (rx.cfg.kind == OUTPUT_UHID || rx.cfg.kind == OUTPUT_FILE)) {
+      i++;
+    } else if (strcmp(argv[i], "--stats") == 0) {
+      show_stats = true;
+    } else {
+      printf("writes reports streamed by pinenote-usb-tablet to local "
+             "devices.\n");
+      printf("Usage: %s [options]\n\n", argv[0]);
+      printf("Options:\n"
+             "  --tcp               listen on tcp instead of udp\n"
+             "  --port <port>       port to listen on (default %d)\n"
+             "  --listen-all        listen on every interface, not only "
+             "on loopback;\n"
+             "                      anyone who can reach the port can "
+             "inject input\n"
+             "  --output <backend>  uhid (default) or file:<prefix>\n"
+             "  --stats             print packet, loss and latency counts "
+             "on exit,\n"
+             "                      and how long after their Scan Time "
+             "reports\n"
+             "                      arrive; latency is only meaningful when "
+             "both\n"
+             "                      ends run on the same machine\n",
+             NET_DEFAULT_PORT);
+      return -1;
+    }
+  }
+
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGINT);
+  sigaddset(&mask, SIGTERM);
+  sigprocmask(SIG_BLOCK, &mask, NULL);
+  sigfd = signalfd(-1, &mask, SFD_CLOEXEC);
+  rx.epfd = epoll_create1(EPOLL_CLOEXEC);
+  sock = socket(AF_INET, (stream ? SOCK_STREAM : SOCK_DGRAM) | SOCK_CLOEXEC,
+                0);
+  if (sigfd < 0 || rx.epfd < 0 || sock < 0) {
+    perror("Failed to set up");
+    goto cleanup;
+  }
+  setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+      (stream && listen(sock, 1) < 0)) {
+    perror("Failed to listen");
+    goto cleanup;
+  }
+  ev.data.fd = sigfd;
+  epoll_ctl(rx.epfd, EPOLL_CTL_ADD, sigfd, &ev);
+  ev.data.fd = sock;
+  epoll_ctl(rx.epfd, EPOLL_CTL_ADD, sock, &ev);
+
+  for (;;) {
+    struct epoll_event events[4];
+    int n = epoll_wait(rx.epfd, events, 4, -1);
+
+    if (n < 0 && errno != EINTR)
+      break;
+    for (int i = 0; i < n; i++) {
+      if (events[i].data.fd == sigfd) {
+        rc = 0;
+        goto cleanup;
+      } else if (events[i].data.fd == sock && stream) {
+        // one sender at a time, a new connection replaces the old one
+        int fd = accept4(sock, NULL, NULL, SOCK_CLOEXEC);
+
+        if (fd < 0) {
+          perror("Failed to accept");
+          continue;
+        }
+        if (client >= 0)
+          close(client);
+        client = fd;
+        setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        ev.data.fd = client;
+        if (epoll_ctl(rx.epfd, EPOLL_CTL_ADD, client, &ev) < 0) {
+          perror("Failed to watch connection");
+          close(client);
+          client = -1;
+        }
+        rx.have_seq = false;
+        used = 0;
+      } else if (events[i].data.fd == sock) {
+        ssize_t len = recv(sock, buf, sizeof(buf), 0);
+
+        if (len > 0 && handle_packet(&rx, buf, len) < 0)
+          goto cleanup;
+      } else if (events[i].data.fd == client) {
+        if (handle_stream(&rx, client, buf, &used) < 0) {
+          close(client);
+          client = -1;
+        }
+      } else {
+        output *out = events[i].data.fd == rx.outs.pen.fd ? &rx.outs.pen
+                                                           : &rx.outs.touch;
+
+        if (out->handle_events(out) < 0)
+          goto cleanup;
+      }
+    }
+  }
+
+cleanup:
+  if (show_stats)
+    print_receiver_stats(&rx);
+  if (rx.opened)
+    close_outputs(&rx.outs);
+  if (client >= 0)
+    close(client);
+  if (sock >= 0)
+    close(sock);
+  if (rx.epfd >= 0)
+    close(rx.epfd);
+  if (sigfd >= 0)
+    close(sigfd);
+  return rc;
+}
@@ -0,0 +1,37 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+#ifndef PINENOTE_NET_H
+#define PINENOTE_NET_H
+
+#include <stdint.h>
+
+// Wire format of the udp/tcp outputs, little endian. Every packet is a
+// header followed by `count` reports; over tcp, packets follow each other
+// on the stream and `size` delimits them. `seq` counts packets, a gap on
+// the receiving side means packets were lost.
+
+#define NET_MAGIC 0x4e50 // "PN"
+#define NET_VERSION 1
+#define NET_DEFAULT_PORT 7531
+// stays under the usual MTU so udp packets are never fragmented
+#define NET_MAX_PACKET 1400
+
+enum { NET_PEN, NET_TOUCH };
+
+typedef struct __attribute__((packed)) {
+  uint16_t magic;
+  uint8_t version;
+  uint8_t count;
+  uint16_t size;          // header included
+  uint8_t touch_contacts; // of the touch descriptor, 0 without touch
+  uint8_t reserved;
+  uint32_t seq;
+} net_header;
+
+typedef struct __attribute__((packed)) {
+  uint64_t time_ns; // sender's CLOCK_MONOTONIC when the report was written
+  uint8_t channel;  // NET_PEN or NET_TOUCH
+  uint8_t len;
+  unsigned char data[];
+} net_report;
+
+#endif
@@ -0,0 +1,838 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+#include "output.h"
+#include "descriptors.h"
+#include "trace.h"
+#include <endian.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/uhid.h>
+#include <linux/usb/ch9.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include <usbg/function/hid.h>
+
+static int remove_gadget(usbg_gadget *g) {
+  int usbg_ret;
+  usbg_udc *u;
+
+  /* Check if gadget is enabled */
+  u = usbg_get_gadget_udc(g);
+
+  /* If gadget is enable we have to disable it first */
+  if (u) {
+    usbg_ret = usbg_disable_gadget(g);
+    if (usbg_ret != USBG_SUCCESS) {
+      fprintf(stderr, "Error on USB disable gadget udc\n");
+      fprintf(stderr, "Error: %s : %s\n", usbg_error_name(usbg_ret),
+              usbg_strerror(usbg_ret));
+      goto out;
+    }
+  }
+
+  /* Remove gadget with USBG_RM_RECURSE flag to remove
+   * also its configurations, functions and strings */
+  usbg_ret = usbg_rm_gadget(g, USBG_RM_RECURSE);
+  if (usbg_ret != USBG_SUCCESS) {
+    fprintf(stderr, "Error on USB gadget remove\n");
+    fprintf(stderr, "Error: %s : %s\n", usbg_error_name(usbg_ret),
+            usbg_strerror(usbg_ret));
+  }
+
+out:
+  return usbg_ret;
+}
+
+static bool gadget_attrs_match(usbg_gadget *g,
+                               const struct usbg_gadget_attrs *want) {
+  struct usbg_gadget_attrs have;
+
+  if (usbg_get_gadget_attrs(g, &have) != USBG_SUCCESS)
+    return false;
+  return have.bcdUSB == want->bcdUSB &&
+         have.bDeviceClass == want->bDeviceClass &&
+         have.bDeviceSubClass == want->bDeviceSubClass &&
+         have.bDeviceProtocol == want->bDeviceProtocol &&
+         have.bMaxPacketSize0 == want->bMaxPacketSize0 &&
+         have.idVendor == want->idVendor &&
+         have.idProduct == want->idProduct &&
+         have.bcdDevice == want->bcdDevice;
+}
+
+static bool gadget_strs_match(usbg_gadget *g,
+                              const struct usbg_gadget_strs *want) {
+  struct usbg_gadget_strs have;
+  bool match;
+
+  if (usbg_get_gadget_strs(g, LANG_US_ENG, &have) != USBG_SUCCESS)
+    return false;
+  match = strcmp(have.manufacturer, want->manufacturer) == 0 &&
+          strcmp(have.product, want->product) == 0 &&
+          strcmp(have.serial, want->serial) == 0;
+  usbg_free_gadget_strs(&have);
+  return match;
+}
+
+static bool hid_attrs_match(usbg_function *f,
+                            const struct usbg_f_hid_attrs *want) {
+  struct usbg_f_hid_attrs have;
+  bool match;
+
+  if (usbg_f_hid_get_attrs(usbg_to_hid_function(f), &have) != USBG_SUCCESS)
+    return false;
+  match = have.protocol == want->protocol &&
+          have.subclass == want->subclass &&
+          have.report_length == want->report_length &&
+          have.report_desc.len == want->report_desc.len &&
+          memcmp(have.report_desc.desc, want->report_desc.desc,
+                 want->report_desc.len) == 0;
+  usbg_f_hid_cleanup_attrs(&have);
+  return match;
+}
+
+// Brings a gadget left over from an earlier run in line with this one, so a
+// restart does not make the host re-enumerate the tablet. Returns 1 if it
+// already matched, 0 if only the parts that differed were rewritten, or a
+// negative value if it has to be removed and created from scratch.
+static int reuse_gadget(usbg_context *usb_ctx, usbg_gadget *g,
+                        const struct usbg_gadget_attrs *g_attrs,
+                        const struct usbg_gadget_strs *g_strs,
+                        const struct usbg_f_hid_attrs *pen_attrs,
+                        const struct usbg_f_hid_attrs *touch_attrs) {
+  usbg_config *c = usbg_get_config(g, 1, NULL);
+  usbg_function *pen = usbg_get_function(g, USBG_F_HID, "usb0");
+  usbg_function *touch = usbg_get_function(g, USBG_F_HID, "usb1");
+  usbg_binding *b, *touch_binding = NULL;
+  bool pen_bound = false;
+  bool attrs_ok, strs_ok, pen_ok, touch_ok;
+
+  if (!c || !pen)
+    return -1;
+  for (b = usbg_get_first_binding(c); b; b = usbg_get_next_binding(b)) {
+    usbg_function *f = usbg_get_binding_target(b);
+
+    if (f == pen && !pen_bound)
+      pen_bound = true;
+    else if (f == touch && touch && !touch_binding)
+      touch_binding = b;
+    else
+      return -1;
+  }
+  if (!pen_bound)
+    return -1;
+
+  attrs_ok = gadget_attrs_match(g, g_attrs);
+  strs_ok = gadget_strs_match(g, g_strs);
+  pen_ok = hid_attrs_match(pen, pen_attrs);
+  if (touch_attrs)
+    touch_ok = touch && touch_binding && hid_attrs_match(touch, touch_attrs);
+  else
+    touch_ok = !touch;
+
+  usb_ctx->g = g;
+  usb_ctx->c = c;
+  usb_ctx->f_hid_w9013 = pen;
+  usb_ctx->f_hid_touch = touch_attrs ? touch : NULL;
+  if (attrs_ok && strs_ok && pen_ok && touch_ok && usbg_get_gadget_udc(g))
+    return 1;
+
+  // function attributes can only change while the gadget is unbound
+  if (usbg_get_gadget_udc(g) && usbg_disable_gadget(g) != USBG_SUCCESS)
+    goto fail;
+  if (!attrs_ok && usbg_set_gadget_attrs(g, g_attrs) != USBG_SUCCESS)
+    goto fail;
+  if (!strs_ok && usbg_set_gadget_strs(g, LANG_US_ENG, g_strs) != USBG_SUCCESS)
+    goto fail;
+  if (!pen_ok && usbg_f_hid_set_attrs(usbg_to_hid_function(pen),
+                                      pen_attrs) != USBG_SUCCESS)
+    goto fail;
+  if (!touch_ok && !touch_attrs) {
+    if (touch_binding && usbg_rm_binding(touch_binding) != USBG_SUCCESS)
+      goto fail;
+    if (usbg_rm_function(touch, USBG_RM_RECURSE) != USBG_SUCCESS)
+      goto fail;
+  } else if (!touch_ok) {
+    if (!touch) {
+      if (usbg_create_function(g, USBG_F_HID, "usb1", (void *)touch_attrs,
+                               &touch) != USBG_SUCCESS)
+        goto fail;
+    } else if (usbg_f_hid_set_attrs(usbg_to_hid_function(touch),
+                                    touch_attrs) != USBG_SUCCESS) {
+      goto fail;
+    }
+    if (!touch_binding &&
+        usbg_add_config_function(c, "touch", touch) != USBG_SUCCESS)
+      goto fail;
+    usb_ctx->f_hid_touch = touch;
+  }
+  if (usbg_enable_gadget(g, DEFAULT_UDC) != USBG_SUCCESS)
+    goto fail;
+  return 0;
+
+fail:
+  usb_ctx->g = NULL;
+  return -1;
+}
+
+static int initUSB(usbg_context *usb_ctx, bool use_cyttsp5, int touch_contacts,
+            uint16_t vendor, uint16_t product) {
+  int usbg_ret = -EINVAL;
+
+  usbg_gadget *old_gadget = NULL;
+  struct usbg_gadget_attrs g_attrs = {
+      .bcdUSB = 0x0200,
+      .bDeviceClass = USB_CLASS_PER_INTERFACE,
+      .bDeviceSubClass = 0x00,
+      .bDeviceProtocol = 0x00,
+      .bMaxPacketSize0 = 64, /* Max allowed ep0 packet size */
+      .idVendor = vendor,
+      .idProduct = product,
+      .bcdDevice = 0x0100, /* Verson of device */
+  };
+  struct usbg_gadget_strs g_strs = {
+      .serial = "fedcba9876543210", /* Serial number */
+      .manufacturer = "Pine64",     /* Manufacturer */
+      .product = "PineNote"         /* Product string */
+  };
+  struct usbg_config_strs c_strs = {.configuration = "2xHID"};
+  struct usbg_f_hid_attrs f_attrs_ws9013 = {
+      .protocol = 0,
+      .report_desc =
+          {
+              .desc = report_desc_pen,
+              .len = build_pen_descriptor(),
+          },
+      .report_length = PEN_REPORT_LEN,
+      .subclass = 0,
+  };
+  struct usbg_f_hid_attrs f_attrs_touch = {
+      .protocol = 0,
+      .report_desc =
+          {
+              .desc = report_desc_touch,
+              .len = build_touch_descriptor(touch_contacts),
+          },
+      .report_length = TOUCH_REPORT_LEN(touch_contacts),
+      .subclass = 0,
+  };
+
+  usbg_ret = usbg_init("/sys/kernel/config", &usb_ctx->s);
+  if (usbg_ret != USBG_SUCCESS) {
+    fprintf(stderr, "Error on usbg init\n");
+    fprintf(stderr, "Error: %s : %s\n", usbg_error_name(usbg_ret),
+            usbg_strerror(usbg_ret));
+    goto out1;
+  }
+
+  old_gadget = usbg_get_gadget(usb_ctx->s, "pinenote-usb-tablet");
+  if (old_gadget) {
+    usbg_ret = reuse_gadget(usb_ctx, old_gadget, &g_attrs, &g_strs,
+                            &f_attrs_ws9013,
+                            use_cyttsp5 ? &f_attrs_touch : NULL);
+    if (usbg_ret >= 0) {
+      fprintf(stderr, usbg_ret ? "Reusing existing gadget\n"
+                               : "Updated existing gadget\n");
+      usbg_ret = 0;
+      goto out1;
+    }
+    fprintf(stderr, "Removing leftover gadget\n");
+    usbg_ret = remove_gadget(old_gadget);
+    if (usbg_ret != USBG_SUCCESS)
+      goto out2;
+  }
+
+  usbg_ret = usbg_create_gadget(usb_ctx->s, "pinenote-usb-tablet", &g_attrs,
+                                &g_strs, &usb_ctx->g);
+  if (usbg_ret != USBG_SUCCESS) {
+    fprintf(stderr, "Error creating gadget\n");
+    fprintf(stderr, "Error: %s : %s\n", usbg_error_name(usbg_ret),
+            usbg_strerror(usbg_ret));
+    goto out2;
+  }
+  usbg_ret = usbg_create_function(usb_ctx->g, USBG_F_HID, "usb0",
+                                  &f_attrs_ws9013, &usb_ctx->f_hid_w9013);
+  if (usbg_ret != USBG_SUCCESS) {
+    fprintf(stderr, "Error creating function\n");
+    fprintf(stderr, "Error: %s : %s\n", usbg_error_name(usbg_ret),
+            usbg_strerror(usbg_ret));
+    goto out2;
+  }
+  if (use_cyttsp5) {
+    usbg_ret = usbg_create_function(usb_ctx->g, USBG_F_HID, "usb1",
+                                    &f_attrs_touch, &usb_ctx->f_hid_touch);
+    if (usbg_ret != USBG_SUCCESS) {
+      fprintf(stderr, "Error creating function\n");
+      fprintf(stderr, "Error: %s : %s\n", usbg_error_name(usbg_ret),
+              usbg_strerror(usbg_ret));
+      goto out2;
+    }
+  }
+  usbg_ret = usbg_create_config(usb_ctx->g, 1, "The only one", NULL, &c_strs,
+                                &usb_ctx->c);
+  if (usbg_ret != USBG_SUCCESS) {
+    fprintf(stderr, "Error creating config\n");
+    fprintf(stderr, "Error: %s : %s\n", usbg_error_name(usbg_ret),
+            usbg_strerror(usbg_ret));
+    goto out2;
+  }
+  usbg_ret =
+      usbg_add_config_function(usb_ctx->c, "w9013", usb_ctx->f_hid_w9013);
+  if (usbg_ret != USBG_SUCCESS) {
+    fprintf(stderr, "Error adding function\n");
+    fprintf(stderr, "Error: %s : %s\n", usbg_error_name(usbg_ret),
+            usbg_strerror(usbg_ret));
+    goto out2;
+  }
+  if (use_cyttsp5) {
+    usbg_ret =
+        usbg_add_config_function(usb_ctx->c, "touch", usb_ctx->f_hid_touch);
+    if (usbg_ret != USBG_SUCCESS) {
+      fprintf(stderr, "Error adding function\n");
+      fprintf(stderr, "Error: %s : %s\n", usbg_error_name(usbg_ret),
+              usbg_strerror(usbg_ret));
+      goto out2;
+    }
+  }
+  usbg_ret = usbg_enable_gadget(usb_ctx->g, DEFAULT_UDC);
+  if (usbg_ret != USBG_SUCCESS) {
+    fprintf(stderr, "Error enabling gadget\n");
+    fprintf(stderr, "Error: %s : %s\n", usbg_error_name(usbg_ret),
+            usbg_strerror(usbg_ret));
+    goto out2;
+  }
+  usbg_ret = 0;
+  goto out1;
+
+out2:
+  usbg_cleanup(usb_ctx->s);
+  usb_ctx->s = NULL;
+  usb_ctx->g = NULL;
+
+out1:
+  return usbg_ret;
+}
+
+static int cleanupUSB(usbg_context *usb_ctx) {
+  if (usb_ctx->g && !usb_ctx->keep) {
+    usbg_disable_gadget(usb_ctx->g);
+    usbg_rm_gadget(usb_ctx->g, USBG_RM_RECURSE);
+  }
+  if (usb_ctx->s) {
+    usbg_cleanup(usb_ctx->s);
+  }
+  return 0;
+}
+
+static ssize_t fd_write(output *out, const void *buf, size_t len) {
+  return write(out->fd, buf, len);
+}
+
+static ssize_t uhid_write(output *out, const void *buf, size_t len) {
+  struct uhid_event ev = {.type = UHID_INPUT2};
+  size_t size = offsetof(struct uhid_event, u.input2.data) + len;
+
+  if (len > UHID_DATA_MAX) {
+    errno = EMSGSIZE;
+    return -1;
+  }
+  ev.u.input2.size = len;
+  memcpy(ev.u.input2.data, buf, len);
+  if (write(out->fd, &ev, size) != (ssize_t)size)
+    return -1;
+  return len;
+}
+
+static int uhid_handle_events(output *out) {
+  struct uhid_event ev, reply = {0};
+
+  while (read(out->fd, &ev, sizeof(ev)) > 0) {
+    // nothing behind the loopback device stores reports, so refuse
+    // feature report requests instead of letting them time out
+    if (ev.type == UHID_GET_REPORT) {
+      reply.type = UHID_GET_REPORT_REPLY;
+      reply.u.get_report_reply.id = ev.u.get_report.id;
+      reply.u.get_report_reply.err = EIO;
+    } else if (ev.type == UHID_SET_REPORT) {
+      reply.type = UHID_SET_REPORT_REPLY;
+      reply.u.set_report_reply.id = ev.u.set_report.id;
+      reply.u.set_report_reply.err = EIO;
+    } else {
+      continue;
+    }
+    if (write(out->fd, &reply, sizeof(reply)) < 0) {
+      perror("Failed to answer uhid request");
+      return -1;
+    }
+  }
+  if (errno != EAGAIN) {
+    perror("Failed to read uhid event");
+    return -1;
+  }
+  return 0;
+}
+
+static int open_uhid(output *out, const char *name, char *desc, int desc_len,
+                     uint16_t vendor, uint16_t product) {
+  struct uhid_event ev = {.type = UHID_CREATE2};
+
+  out->fd = open("/dev/uhid", O_RDWR | O_NONBLOCK | O_CLOEXEC);
+  if (out->fd < 0) {
+    perror("Failed to open /dev/uhid");
+    return -1;
+  }
+  snprintf((char *)ev.u.create2.name, sizeof(ev.u.create2.name), "%s", name);
+  ev.u.create2.rd_size = desc_len;
+  ev.u.create2.bus = BUS_VIRTUAL;
+  ev.u.create2.vendor = vendor;
+  ev.u.create2.product = product;
+  memcpy(ev.u.create2.rd_data, desc, desc_len);
+  if (write(out->fd, &ev, sizeof(ev)) != sizeof(ev)) {
+    fprintf(stderr, "Failed to create uhid device %s: %s\n", name,
+            strerror(errno));
+    return -1;
+  }
+  out->write = uhid_write;
+  out->handle_events = uhid_handle_events;
+  return 0;
+}
+
+static int open_report_file(output *out, const char *prefix, int index,
+                            int flags) {
+  char path[256];
+
+  snprintf(path, sizeof(path), "%s%d", prefix, index);
+  out->fd = open(path, flags, 0644);
+  if (out->fd < 0) {
+    fprintf(stderr, "Failed to open %s: %s\n", path, strerror(errno));
+    return -1;
+  }
+  out->write = fd_write;
+  out->handle_events = NULL;
+  return 0;
+}
+
+static int net_send(net_link *l) {
+  net_header *h = (net_header *)l->buf;
+  size_t sent = 0;
+  ssize_t r;
+
+  if (!l->count)
+    return 0;
+  h->magic = htole16(NET_MAGIC);
+  h->version = NET_VERSION;
+  h->count = l->count;
+  h->size = htole16(l->used);
+  h->touch_contacts = l->touch_contacts;
+  h->reserved = 0;
+  h->seq = htole32(l->seq++);
+  l->count = 0;
+
+  // tcp may take a packet in pieces
+  while (sent < l->used) {
+    r = send(l->fd, l->buf + sent, l->used - sent, MSG_NOSIGNAL);
+    if (r < 0 && errno == EINTR)
+      continue;
+    if (r < 0) {
+      l->send_errors++;
+      l->used = sizeof(net_header);
+      // udp hears about a missing receiver as ECONNREFUSED on a later
+      // send, keep going so it gets the reports once it is back
+      if (!l->stream)
+        return 0;
+      perror("Failed to send reports");
+      return -1;
+    }
+    sent += r;
+  }
+  l->packets++;
+  l->used = sizeof(net_header);
+  return 0;
+}
+
+static ssize_t net_write(output *out, const void *buf, size_t len) {
+  net_link *l = out->net;
+  net_report *r;
+
+  if (l->used + sizeof(*r) + len > sizeof(l->buf) || l->count == UINT8_MAX) {
+    if (net_send(l) < 0)
+      return -1;
+  }
+  r = (net_report *)(l->buf + l->used);
+  r->time_ns = htole64(monotonic_ns());
+  r->channel = out->channel;
+  r->len = len;
+  memcpy(r->data, buf, len);
+  l->used += sizeof(*r) + len;
+  l->count++;
+  l->reports++;
+  return len;
+}
+
+static int open_net(outputs *o, const output_config *cfg) {
+  struct addrinfo hints = {0}, *res;
+  const char *colon = strrchr(cfg->path, ':');
+  char host[256], port[16];
+  int one = 1, priority = 6, tos = IPTOS_LOWDELAY, rc;
+  net_link *l;
+
+  if (colon) {
+    snprintf(host, sizeof(host), "%.*s", (int)(colon - cfg->path), cfg->path);
+    snprintf(port, sizeof(port), "%s", colon + 1);
+  } else {
+    snprintf(host, sizeof(host), "%s", cfg->path);
+    snprintf(port, sizeof(port), "%d", NET_DEFAULT_PORT);
+  }
+  // pinenote-net-receiver listens on IPv4 only, "localhost" must not
+  // resolve to ::1
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = cfg->kind == OUTPUT_TCP ? SOCK_STREAM : SOCK_DGRAM;
+  if ((rc = getaddrinfo(host, port, &hints, &res)) != 0) {
+    fprintf(stderr, "Failed to resolve %s: %s\n", cfg->path,
+            gai_strerror(rc));
+    return -1;
+  }
+  if (!(l = calloc(1, sizeof(*l)))) {
+    freeaddrinfo(res);
+    return -1;
+  }
+  o->net = l;
+  l->stream = cfg->kind == OUTPUT_TCP;
+  l->touch_contacts = cfg->use_touch ? cfg->touch_contacts : 0;
+  l->used = sizeof(net_header);
+  l->fd = socket(res->ai_family, res->ai_socktype | SOCK_CLOEXEC, 0);
+  if (l->fd < 0 || connect(l->fd, res->ai_addr, res->ai_addrlen) < 0) {
+    fprintf(stderr, "Failed to connect to %s: %s\n", cfg->path,
+            strerror(errno));
+    freeaddrinfo(res);
+    return -1;
+  }
+  // best effort, the reports are tiny and latency is all that matters
+  setsockopt(l->fd, SOL_SOCKET, SO_PRIORITY, &priority, sizeof(priority));
+  if (res->ai_family == AF_INET)
+    setsockopt(l->fd, IPPROTO_IP, IP_TOS, &tos, sizeof(tos));
+  if (l->stream)
+    setsockopt(l->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  freeaddrinfo(res);
+
+  o->pen.net = l;
+  o->pen.channel = NET_PEN;
+  o->pen.write = net_write;
+  if (cfg->use_touch) {
+    o->touch.net = l;
+    o->touch.channel = NET_TOUCH;
+    o->touch.write = net_write;
+  }
+  return 0;
+}
+
+int output_send_batch(outputs *o) { return o->net ? net_send(o->net) : 0; }
+
+uint64_t output_writes(const outputs *o) {
+  return o->pen.writes + o->touch.writes + (o->net ? o->net->packets : 0);
+}
+
+// pen motion with unchanged tip, in-range and button bits
+static bool pen_can_replace(const unsigned char *old, const unsigned char *new,
+                            size_t len) {
+  return len == PEN_REPORT_LEN && old[0] == PEN_REPORT_ID &&
+         new[0] == PEN_REPORT_ID && old[1] == new[1];
+}
+
+// touch frame with the same contacts in the same tip state
+static bool touch_can_replace(const unsigned char *old,
+                              const unsigned char *new, size_t len) {
+  size_t count = len - 3;
+
+  if (old[count] != new[count])
+    return false;
+  for (size_t i = 1; i < count; i += TOUCH_CONTACT_LEN) {
+    if (old[i] != new[i])
+      return false;
+  }
+  return true;
+}
+
+static void output_set_events(output *out, uint32_t events) {
+  struct epoll_event ev = {.events = events, .data.ptr = out->epoll_data};
+
+  if (out->epfd < 0 || events == out->epoll_events)
+    return;
+  if (epoll_ctl(out->epfd, EPOLL_CTL_MOD, out->fd, &ev) == 0)
+    out->epoll_events = events;
+}
+
+static void queue_push(output *out, const void *buf, size_t len) {
+  output_queue *q = out->queue;
+  queued_report *r;
+
+  if (q->count) {
+    r = &q->reports[(q->head + q->count - 1) % OUTPUT_QUEUE_LEN];
+    if (r->len == len && q->can_replace(r->data, buf, len)) {
+      memcpy(r->data, buf, len);
+      q->coalesced++;
+      return;
+    }
+  }
+  // the host may have read since the last write would have blocked
+  if (q->count == OUTPUT_QUEUE_LEN)
+    output_flush(out);
+  // Each queued report changes the state of the one before it, or it
+  // would have replaced it, so a full queue holds nothing but transitions.
+  // The last resort loses the oldest of them.
+  if (q->count == OUTPUT_QUEUE_LEN) {
+    q->head = (q->head + 1) % OUTPUT_QUEUE_LEN;
+    q->count--;
+    q->transitions_dropped++;
+    if (out->metrics)
+      metrics_add(&out->metrics->transitions_dropped, 1);
+  }
+  r = &q->reports[(q->head + q->count) % OUTPUT_QUEUE_LEN];
+  r->len = len;
+  memcpy(r->data, buf, len);
+  q->count++;
+  q->queued++;
+  output_set_events(out, out->epoll_events | EPOLLOUT);
+}
+
+static void count_write(output *out, ssize_t r) {
+  if (!out->metrics)
+    return;
+  metrics_add(&out->metrics->writes, 1);
+  if (r > 0)
+    metrics_add(&out->metrics->bytes, r);
+  else if (r < 0 && errno == ESHUTDOWN)
+    metrics_add(&out->metrics->shutdown, 1);
+}
+
+ssize_t output_write(output *out, const void *buf, size_t len) {
+  ssize_t r;
+
+  if (out->queue && out->queue->count) {
+    queue_push(out, buf, len);
+    return len;
+  }
+  out->writes += !out->net;
+  r = out->write(out, buf, len);
+  if (r < 0 && errno == EAGAIN && out->queue && len <= OUTPUT_REPORT_MAX) {
+    queue_push(out, buf, len);
+    return len;
+  }
+  count_write(out, r);
+  return r;
+}
+
+int output_flush(output *out) {
+  output_queue *q = out->queue;
+
+  while (q && q->count) {
+    queued_report *r = &q->reports[q->head];
+
+    ssize_t n;
+
+    out->writes++;
+    n = out->write(out, r->data, r->len);
+    if (n != r->len) {
+      if (errno == EAGAIN)
+        return 0;
+      if (errno != ESHUTDOWN) {
+        perror("Write failed");
+        return -1;
+      }
+    }
+    count_write(out, n);
+    q->head = (q->head + 1) % OUTPUT_QUEUE_LEN;
+    q->count--;
+  }
+  output_set_events(out, out->epoll_events & ~EPOLLOUT);
+  return 0;
+}
+
+int output_drain(outputs *o, int timeout_ms) {
+  output *outs[] = {&o->pen, &o->touch};
+  struct timespec ts;
+  int64_t now, deadline;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  deadline = ts.tv_sec * 1000 + ts.tv_nsec / 1000000 + timeout_ms;
+  for (int i = 0; i < 2; i++) {
+    output *out = outs[i];
+
+    while (out->queue && out->queue->count) {
+      struct pollfd pfd = {.fd = out->fd, .events = POLLOUT};
+
+      clock_gettime(CLOCK_MONOTONIC, &ts);
+      now = ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+      if (now >= deadline) {
+        fprintf(stderr, "%s output: %u queued reports not sent\n",
+                out->name, out->queue->count);
+        return -1;
+      }
+      if (poll(&pfd, 1, deadline - now) < 0 && errno != EINTR) {
+        perror("poll");
+        return -1;
+      }
+      if (output_flush(out) < 0)
+        return -1;
+    }
+  }
+  return 0;
+}
+
+int output_watch(output *out, int epfd, void *data) {
+  struct epoll_event ev = {.data.ptr = data};
+
+  ev.events = out->handle_events ? EPOLLIN : 0;
+  if (epoll_ctl(epfd, EPOLL_CTL_ADD, out->fd, &ev) < 0) {
+    fprintf(stderr, "Failed to watch %s output: %s\n", out->name,
+            strerror(errno));
+    return -1;
+  }
+  out->epfd = epfd;
+  out->epoll_data = data;
+  out->epoll_events = ev.events;
+  return 0;
+}
+
+static int make_nonblocking(output *out,
+                            bool (*can_replace)(const unsigned char *,
+                                                const unsigned char *,
+                                                size_t)) {
+  if (out->fd < 0)
+    return 0;
+  if (!(out->queue = calloc(1, sizeof(*out->queue)))) {
+    perror("Failed to allocate output queue");
+    return -1;
+  }
+  out->queue->can_replace = can_replace;
+  return fcntl(out->fd, F_SETFL, fcntl(out->fd, F_GETFL) | O_NONBLOCK);
+}
+
+void print_output_stats(outputs *o) {
+  output *outs[] = {&o->pen, &o->touch};
+
+  for (int i = 0; i < 2; i++) {
+    output_queue *q = outs[i]->queue;
+    if (!q)
+      continue;
+    fprintf(stderr,
+            "%s output: %llu queued, %llu coalesced, %llu transitions "
+            "dropped\n",
+            outs[i]->name, (unsigned long long)q->queued,
+            (unsigned long long)q->coalesced,
+            (unsigned long long)q->transitions_dropped);
+  }
+  if (o->net)
+    fprintf(stderr,
+            "network output: %llu reports in %llu packets (%.2f/packet), "
+            "%llu send errors\n",
+            (unsigned long long)o->net->reports,
+            (unsigned long long)o->net->packets,
+            o->net->packets ? (double)o->net->reports / o->net->packets : 0.0,
+            (unsigned long long)o->net->send_errors);
+}
+
+int parse_output(const char *arg, output_config *cfg) {
+  if (strcmp(arg, "gadget") == 0) {
+    cfg->kind = OUTPUT_GADGET;
+  } else if (strcmp(arg, "uhid") == 0) {
+    cfg->kind = OUTPUT_UHID;
+  } else if (strncmp(arg, "file:", 5) == 0 && arg[5]) {
+    cfg->kind = OUTPUT_FILE;
+    cfg->path = arg + 5;
+  } else if (strncmp(arg, "udp:", 4) == 0 && arg[4]) {
+    cfg->kind = OUTPUT_UDP;
+    cfg->path = arg + 4;
+  } else if (strncmp(arg, "tcp:", 4) == 0 && arg[4]) {
+    cfg->kind = OUTPUT_TCP;
+    cfg->path = arg + 4;
+  } else {
+    return -1;
+  }
+  return 0;
+}
+
+int open_outputs(outputs *o, const output_config *cfg) {
+  int touch_desc_len = build_touch_descriptor(cfg->touch_contacts);
+
+  o->kind = cfg->kind;
+  o->pen = (output){.name = "pen", .fd = -1, .epfd = -1};
+  o->touch = (output){.name = "touch", .fd = -1, .epfd = -1};
+  if (touch_desc_len < 0) {
+    fprintf(stderr, "Invalid touch contact count %d\n", cfg->touch_contacts);
+    return -1;
+  }
+
+  switch (cfg->kind) {
+  case OUTPUT_GADGET:
+    o->usb.keep = cfg->keep_gadget;
+    if (initUSB(&o->usb, cfg->use_touch, cfg->touch_contacts, cfg->vendor,
+                cfg->product) < 0) {
+      fprintf(stderr, "Failed to init usb gadget\n");
+      return -1;
+    }
+    if (open_report_file(&o->pen, "/dev/hidg", 0, O_WRONLY) < 0)
+      return -1;
+    if (cfg->use_touch && open_report_file(&o->touch, "/dev/hidg", 1,
+                                           O_WRONLY) < 0)
+      return -1;
+    break;
+  case OUTPUT_UHID:
+    if (open_uhid(&o->pen, "PineNote pen (uhid)", report_desc_pen,
+                  build_pen_descriptor(), cfg->vendor, cfg->product) < 0)
+      return -1;
+    if (cfg->use_touch &&
+        open_uhid(&o->touch, "PineNote touch (uhid)", report_desc_touch,
+                  touch_desc_len, cfg->vendor, cfg->product) < 0)
+      return -1;
+    break;
+  case OUTPUT_FILE:
+    if (open_report_file(&o->pen, cfg->path, 0,
+                         O_WRONLY | O_CREAT | O_TRUNC) < 0)
+      return -1;
+    if (cfg->use_touch && open_report_file(&o->touch, cfg->path, 1,
+                                           O_WRONLY | O_CREAT | O_TRUNC) < 0)
+      return -1;
+    break;
+  case OUTPUT_UDP:
+  case OUTPUT_TCP:
+    if (open_net(o, cfg) < 0)
+      return -1;
+    break;
+  }
+
+  // uhid writes never block, so there is nothing to queue for it
+  if (cfg->nonblock && cfg->kind != OUTPUT_UHID &&
+      (make_nonblocking(&o->pen, pen_can_replace) < 0 ||
+       make_nonblocking(&o->touch, touch_can_replace) < 0))
+    return -1;
+  return 0;
+}
+
+void close_outputs(outputs *o) {
+  // closing a uhid fd destroys the device
+  if (o->pen.fd >= 0)
+    close(o->pen.fd);
+  if (o->touch.fd >= 0)
+    close(o->touch.fd);
+  free(o->pen.queue);
+  free(o->touch.queue);
+  if (o->net) {
+    net_send(o->net);
+    if (o->net->fd >= 0)
+      close(o->net->fd);
+    free(o->net);
+    o->net = NULL;
+  }
+  if (o->kind == OUTPUT_GADGET)
+    cleanupUSB(&o->usb);
+}
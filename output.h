@@ -0,0 +1,132 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+#ifndef PINENOTE_OUTPUT_H
+#define PINENOTE_OUTPUT_H
+
+#include "metrics.h"
+#include "net.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <usbg/usbg.h>
+
+typedef enum {
+  OUTPUT_GADGET,
+  OUTPUT_UHID,
+  OUTPUT_FILE,
+  OUTPUT_UDP,
+  OUTPUT_TCP
+} output_kind;
+
+typedef struct output output;
+
+#define OUTPUT_QUEUE_LEN 16
+#define OUTPUT_REPORT_MAX 64
+
+typedef struct {
+  uint8_t len;
+  unsigned char data[OUTPUT_REPORT_MAX];
+} queued_report;
+
+// Reports that would block on a non-blocking output wait here, in order.
+// A new report replaces the newest queued one when can_replace() says it
+// only carries newer data for the same state (e.g. pen motion with the
+// same tip/in-range/button bits), so transitions are never coalesced away.
+// They are only lost when the queue is full of them, oldest first, and
+// counted as transitions_dropped.
+typedef struct {
+  queued_report reports[OUTPUT_QUEUE_LEN];
+  unsigned int head;
+  unsigned int count;
+  bool (*can_replace)(const unsigned char *old, const unsigned char *new,
+                      size_t len);
+  uint64_t queued;
+  uint64_t coalesced;
+  uint64_t transitions_dropped;
+} output_queue;
+
+// One socket shared by the pen and touch outputs. Reports written during
+// one pass of the event loop are collected and sent as a single packet
+// when the pass ends, so batching never holds a report back.
+typedef struct {
+  int fd;
+  bool stream; // tcp
+  uint8_t touch_contacts;
+  uint32_t seq;
+  uint8_t count;
+  size_t used;
+  unsigned char buf[NET_MAX_PACKET];
+  uint64_t packets;
+  uint64_t reports;
+  uint64_t send_errors;
+} net_link;
+
+struct output {
+  const char *name;
+  int fd;
+  ssize_t (*write)(output *out, const void *buf, size_t len);
+  // answers requests coming back from the backend, NULL if it sends none
+  int (*handle_events)(output *out);
+  output_queue *queue; // NULL unless the output is non-blocking
+  int epfd;
+  void *epoll_data;
+  uint32_t epoll_events;
+  net_link *net; // set for the udp/tcp outputs
+  uint8_t channel;
+  uint64_t writes; // write() calls, udp/tcp sends are counted per packet
+  metrics_output *metrics; // NULL when nothing reads them
+};
+
+typedef struct {
+  usbg_state *s;
+  usbg_gadget *g;
+  usbg_config *c;
+  usbg_function *f_hid_w9013;
+  usbg_function *f_hid_touch;
+  bool keep; // leave the gadget bound on exit for the next run to reuse
+} usbg_context;
+
+typedef struct {
+  output_kind kind;
+  // prefix of the two report files for OUTPUT_FILE, which are truncated
+  // when opened, so each run leaves only its own reports; <host>[:<port>] for
+  // OUTPUT_UDP and OUTPUT_TCP
+  const char *path;
+  bool use_touch;
+  int touch_contacts;
+  uint16_t vendor;
+  uint16_t product;
+  bool nonblock;
+  bool keep_gadget;
+} output_config;
+
+typedef struct {
+  output_kind kind;
+  usbg_context usb;
+  output pen;
+  output touch;
+  net_link *net;
+} outputs;
+
+// parses "gadget", "uhid", "file:<prefix>", "udp:<host>[:<port>]" or
+// "tcp:<host>[:<port>]"
+int parse_output(const char *arg, output_config *cfg);
+int open_outputs(outputs *o, const output_config *cfg);
+void close_outputs(outputs *o);
+
+// writes a report, or queues it if the output is non-blocking and busy;
+// returns len in both cases
+ssize_t output_write(output *out, const void *buf, size_t len);
+// writes queued reports until the output would block again
+int output_flush(output *out);
+// waits for the queued reports of both outputs to be written, at most
+// timeout_ms in all, for when there is no event loop left to flush them
+int output_drain(outputs *o, int timeout_ms);
+// registers the output with epoll, the queue adds EPOLLOUT while non-empty
+int output_watch(output *out, int epfd, void *data);
+// sends the reports collected for the udp/tcp outputs, if any
+int output_send_batch(outputs *o);
+// write() and send() calls made so far, for --stats
+uint64_t output_writes(const outputs *o);
+void print_output_stats(outputs *o);
+
+#endif
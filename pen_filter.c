@@ -0,0 +1,158 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+#include "pen_filter.h"
+#include "descriptors.h"
+#include <stdlib.h>
+#include <string.h>
+
+// 1e6 / (2 * pi), times 1000 because cutoffs are in mHz
+#define TAU_US_MHZ 159154943LL
+
+static const struct {
+  int offset;
+  int32_t min;
+  int32_t max;
+} channels[PEN_N_CHANNELS] = {
+    [PEN_CH_X] = {PEN_X, 0, PEN_MAX_X},
+    [PEN_CH_Y] = {PEN_Y, 0, PEN_MAX_Y},
+    [PEN_CH_PRESSURE] = {PEN_PRESSURE, 0, PEN_MAX_PRESSURE},
+    [PEN_CH_X_TILT] = {PEN_X_TILT, -PEN_MAX_TILT, PEN_MAX_TILT},
+    [PEN_CH_Y_TILT] = {PEN_Y_TILT, -PEN_MAX_TILT, PEN_MAX_TILT},
+};
+
+int pen_filter_parse(pen_filter *f, const char *arg) {
+  double min_cutoff, beta, predict_ms = 0;
+  int n;
+
+  memset(f, 0, sizeof(*f));
+  if (strcmp(arg, "bypass") == 0)
+    return 0;
+  n = sscanf(arg, "%lf,%lf,%lf", &min_cutoff, &beta, &predict_ms);
+  if (n < 2 || min_cutoff <= 0 || beta < 0 || predict_ms < 0)
+    return -1;
+  f->enabled = true;
+  f->min_cutoff_mhz = min_cutoff * 1000;
+  f->beta_u = beta * 1e6;
+  f->d_cutoff_mhz = 1000;
+  f->predict_us = predict_ms * 1000;
+  return 0;
+}
+
+static int32_t get_field(const unsigned char *report, int ch) {
+  if (ch >= PEN_CH_X_TILT) {
+    int16_t v;
+    memcpy(&v, &report[channels[ch].offset], 2);
+    return v;
+  } else {
+    uint16_t v;
+    memcpy(&v, &report[channels[ch].offset], 2);
+    return v;
+  }
+}
+
+static void set_field(unsigned char *report, int ch, int64_t v) {
+  uint16_t raw;
+
+  if (v < channels[ch].min)
+    v = channels[ch].min;
+  if (v > channels[ch].max)
+    v = channels[ch].max;
+  raw = (uint16_t)(int16_t)v;
+  memcpy(&report[channels[ch].offset], &raw, 2);
+}
+
+// smoothing factor for a sample period and cutoff, Q16
+static int64_t alpha(int64_t te_us, int64_t cutoff_mhz) {
+  int64_t tau_us = TAU_US_MHZ / (cutoff_mhz > 0 ? cutoff_mhz : 1);
+
+  return (te_us << 16) / (te_us + tau_us);
+}
+
+static void euro_update(const pen_filter *f, euro_channel *c, int32_t raw,
+                        int64_t te_us) {
+  int64_t x = (int64_t)raw << 8;
+  int64_t dx = (x - c->value) * 1000000 / te_us;
+  int64_t a_d = alpha(te_us, f->d_cutoff_mhz);
+  int64_t cutoff, step;
+
+  c->deriv += ((dx - c->deriv) * a_d) >> 16;
+  cutoff = f->min_cutoff_mhz + f->beta_u * (llabs(c->deriv) >> 8) / 1000;
+  step = ((x - c->value) * alpha(te_us, cutoff)) >> 16;
+  c->value += step;
+  c->velocity += ((step * 1000000 / te_us - c->velocity) * a_d) >> 16;
+}
+
+static uint32_t second_diff(int32_t hist[2][2], int32_t x, int32_t y) {
+  uint32_t d = abs(x - 2 * hist[0][0] + hist[1][0]) +
+               abs(y - 2 * hist[0][1] + hist[1][1]);
+
+  hist[1][0] = hist[0][0];
+  hist[1][1] = hist[0][1];
+  hist[0][0] = x;
+  hist[0][1] = y;
+  return d;
+}
+
+void pen_filter_apply(pen_filter *f, unsigned char *report, uint64_t t_ns) {
+  uint8_t state = report[1] & (PEN_TIP | PEN_IN_RANGE);
+  int32_t raw[PEN_N_CHANNELS];
+  int64_t te_us, vx, vy, speed2;
+
+  for (int i = 0; i < PEN_N_CHANNELS; i++)
+    raw[i] = get_field(report, i);
+
+  if (!f->primed || state != f->state || !(state & PEN_IN_RANGE)) {
+    for (int i = 0; i < PEN_N_CHANNELS; i++)
+      f->ch[i] = (euro_channel){.value = (int64_t)raw[i] << 8};
+    for (int i = 0; i < 2; i++) {
+      f->raw_hist[i][0] = f->out_hist[i][0] = raw[PEN_CH_X];
+      f->raw_hist[i][1] = f->out_hist[i][1] = raw[PEN_CH_Y];
+    }
+    f->primed = true;
+    f->state = state;
+    f->last_ns = t_ns;
+    return;
+  }
+
+  te_us = (t_ns - f->last_ns) / 1000;
+  if (te_us < 100)
+    te_us = 100;
+  else if (te_us > 100000)
+    te_us = 100000;
+  f->last_ns = t_ns;
+
+  for (int i = 0; i < PEN_N_CHANNELS; i++) {
+    int64_t v;
+
+    euro_update(f, &f->ch[i], raw[i], te_us);
+    v = f->ch[i].value;
+    if (i <= PEN_CH_Y)
+      v += f->ch[i].velocity * f->predict_us / 1000000;
+    set_field(report, i, (v + 128) >> 8);
+  }
+
+  f->filtered++;
+  vx = raw[PEN_CH_X] - f->raw_hist[0][0];
+  vy = raw[PEN_CH_Y] - f->raw_hist[0][1];
+  speed2 = vx * vx + vy * vy;
+  if (speed2 >= 4) {
+    int64_t ex = get_field(report, PEN_CH_X) - raw[PEN_CH_X];
+    int64_t ey = get_field(report, PEN_CH_Y) - raw[PEN_CH_Y];
+    f->lag_us_sum -= (ex * vx + ey * vy) * te_us / speed2;
+    f->lag_samples++;
+  }
+  f->raw_jitter_sum += second_diff(f->raw_hist, raw[PEN_CH_X], raw[PEN_CH_Y]);
+  f->out_jitter_sum += second_diff(f->out_hist, get_field(report, PEN_CH_X),
+                                   get_field(report, PEN_CH_Y));
+}
+
+void pen_filter_print_stats(const pen_filter *f, FILE *out) {
+  if (!f->enabled || !f->filtered)
+    return;
+  fprintf(out,
+          "pen filter: %llu reports, mean lag %.2f ms, jitter %.1f -> %.1f "
+          "units/report\n",
+          (unsigned long long)f->filtered,
+          f->lag_samples ? f->lag_us_sum / 1e3 / f->lag_samples : 0.0,
+          (double)f->raw_jitter_sum / f->filtered,
+          (double)f->out_jitter_sum / f->filtered);
+}
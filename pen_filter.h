@@ -0,0 +1,58 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+#ifndef PINENOTE_PEN_FILTER_H
+#define PINENOTE_PEN_FILTER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// One-euro filter over X/Y/pressure/tilt of Report ID 2, with optional
+// linear prediction of X/Y from the filtered velocity. Everything is
+// integer math on fixed state; reports whose tip or in-range bit changed
+// are passed through untouched and restart the filter.
+
+enum {
+  PEN_CH_X,
+  PEN_CH_Y,
+  PEN_CH_PRESSURE,
+  PEN_CH_X_TILT,
+  PEN_CH_Y_TILT,
+  PEN_N_CHANNELS
+};
+
+typedef struct {
+  int64_t value;    // Q8
+  int64_t deriv;    // Q8 units/s, drives the adaptive cutoff
+  int64_t velocity; // Q8 units/s of the filtered value, drives prediction
+} euro_channel;
+
+typedef struct {
+  bool enabled;
+  int32_t min_cutoff_mhz;
+  int32_t beta_u; // beta * 1e6
+  int32_t d_cutoff_mhz;
+  int32_t predict_us;
+
+  bool primed;
+  uint8_t state;
+  uint64_t last_ns;
+  euro_channel ch[PEN_N_CHANNELS];
+
+  // how far the output trails (or with prediction, leads) the input along
+  // the direction of motion, converted to time, and the second difference
+  // of both position streams, summed over filtered reports
+  uint64_t filtered;
+  int64_t lag_us_sum;
+  uint64_t lag_samples;
+  uint64_t raw_jitter_sum;
+  uint64_t out_jitter_sum;
+  int32_t raw_hist[2][2];
+  int32_t out_hist[2][2];
+} pen_filter;
+
+// parses "<min cutoff hz>,<beta>[,<prediction ms>]" or "bypass"
+int pen_filter_parse(pen_filter *f, const char *arg);
+void pen_filter_apply(pen_filter *f, unsigned char *report, uint64_t t_ns);
+void pen_filter_print_stats(const pen_filter *f, FILE *out);
+
+#endif
@@ -0,0 +1,125 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+#include "pen_resample.h"
+#include <stdlib.h>
+#include <string.h>
+
+// longer gaps are the pen pausing, not its report rate
+#define MAX_INTERVAL_NS 20000000
+
+int pen_resample_parse(pen_resample *r, const char *arg) {
+  char *end;
+  double hz = strtod(arg, &end);
+
+  memset(r, 0, sizeof(*r));
+  if (*end || hz < 1 || hz > 10000)
+    return -1;
+  r->enabled = true;
+  r->period_ns = 1e9 / hz;
+  return 0;
+}
+
+int pen_resample_push(pen_resample *r, const unsigned char *report,
+                      uint64_t t_ns) {
+  int flags = 0;
+
+  if (r->n && report[1] == r->r[1][1]) {
+    uint64_t dt = t_ns - r->t[1];
+
+    if (dt < MAX_INTERVAL_NS)
+      r->interval_ns = r->interval_ns ? (r->interval_ns * 7 + dt) / 8 : dt;
+    memcpy(r->r[0], r->r[1], W9013_REPORT_LEN);
+    r->t[0] = r->t[1];
+    r->n = 2;
+  } else {
+    // first sample or a state change: it goes out as it is and
+    // interpolation starts over from it
+    r->n = 1;
+    r->emitted_ns = t_ns;
+    r->transitions++;
+    flags |= PEN_RESAMPLE_EMIT;
+  }
+  memcpy(r->r[1], report, W9013_REPORT_LEN);
+  r->t[1] = t_ns;
+
+  if (!r->running && report[1] & PEN_IN_RANGE) {
+    r->running = true;
+    r->next_tick_ns = t_ns + r->period_ns;
+    flags |= PEN_RESAMPLE_START;
+  }
+  return flags;
+}
+
+static int32_t field(const unsigned char *report, int offset, bool is_signed) {
+  uint16_t v;
+
+  memcpy(&v, &report[offset], 2);
+  return is_signed ? (int16_t)v : v;
+}
+
+bool pen_resample_tick(pen_resample *r, uint64_t tick_ns, uint64_t late_ns,
+                       unsigned char *out) {
+  static const struct {
+    int offset;
+    bool is_signed;
+  } fields[] = {{PEN_X, false},
+                {PEN_Y, false},
+                {PEN_PRESSURE, false},
+                {PEN_X_TILT, true},
+                {PEN_Y_TILT, true}};
+  uint64_t target = tick_ns - r->interval_ns;
+  int64_t f;
+
+  r->ticks++;
+  r->late_sum_ns += late_ns;
+  r->late_samples++;
+  if (late_ns > r->late_max_ns)
+    r->late_max_ns = late_ns;
+  if (!(r->r[1][1] & PEN_IN_RANGE)) {
+    r->running = false;
+    return false;
+  }
+  // the newest sample already went out, or this point in time did
+  if (r->emitted_ns >= r->t[1] || target <= r->emitted_ns) {
+    r->skipped++;
+    return false;
+  }
+  memcpy(out, r->r[1], W9013_REPORT_LEN);
+  if (target >= r->t[1]) {
+    r->emitted_ns = r->t[1];
+    r->held++;
+    return true;
+  }
+  if (target <= r->t[0]) {
+    memcpy(out, r->r[0], W9013_REPORT_LEN);
+    r->emitted_ns = r->t[0];
+    r->held++;
+    return true;
+  }
+
+  // Q16 position of target between the two samples
+  f = ((target - r->t[0]) << 16) / (r->t[1] - r->t[0]);
+  for (size_t i = 0; i < sizeof(fields) / sizeof(fields[0]); i++) {
+    int32_t a = field(r->r[0], fields[i].offset, fields[i].is_signed);
+    int32_t b = field(r->r[1], fields[i].offset, fields[i].is_signed);
+    uint16_t v = (uint16_t)(a + (((int64_t)(b - a) * f) >> 16));
+
+    memcpy(&out[fields[i].offset], &v, 2);
+  }
+  r->emitted_ns = target;
+  r->interpolated++;
+  return true;
+}
+
+void pen_resample_print_stats(const pen_resample *r, FILE *out) {
+  if (!r->enabled || !r->ticks)
+    return;
+  fprintf(out,
+          "pen resample: %llu ticks, %llu interpolated, %llu held, %llu "
+          "skipped, %llu missed, %llu transitions passed through\n",
+          (unsigned long long)r->ticks, (unsigned long long)r->interpolated,
+          (unsigned long long)r->held, (unsigned long long)r->skipped,
+          (unsigned long long)r->missed, (unsigned long long)r->transitions);
+  if (r->late_samples)
+    fprintf(out, "pen resample: tick lateness mean %.1f us, max %.1f us\n",
+            r->late_sum_ns / 1e3 / r->late_samples, r->late_max_ns / 1e3);
+}
@@ -0,0 +1,57 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+#ifndef PINENOTE_PEN_RESAMPLE_H
+#define PINENOTE_PEN_RESAMPLE_H
+
+#include "descriptors.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Re-times Report ID 2 to a fixed rate. Samples are buffered with their
+// arrival time, and every tick sends X/Y/pressure/tilt interpolated
+// between the last two at one input interval in the past, so the host
+// gets one report per period whatever the digitizer's own cadence. A
+// report whose tip, in-range or button bits differ goes out at once and
+// restarts the buffer, so transitions are never moved or blended. The
+// caller owns the timer: ticks run while the pen is in range.
+
+enum {
+  PEN_RESAMPLE_EMIT = 1,  // send the pushed report now
+  PEN_RESAMPLE_START = 2, // start ticking at next_tick_ns
+};
+
+typedef struct {
+  bool enabled;
+  uint64_t period_ns;
+
+  bool running;
+  int n;          // buffered samples, the newest is always [1]
+  uint64_t t[2];
+  unsigned char r[2][W9013_REPORT_LEN];
+  uint64_t interval_ns; // smoothed input interval, the interpolation delay
+  uint64_t emitted_ns;  // position of the last report sent
+  uint64_t next_tick_ns;
+
+  uint64_t ticks;
+  uint64_t interpolated;
+  uint64_t held;    // newest sample sent as is
+  uint64_t skipped; // nothing newer than the last report
+  uint64_t missed;  // ticks that passed before the timer was serviced
+  uint64_t transitions;
+  uint64_t late_sum_ns;
+  uint64_t late_max_ns;
+  uint64_t late_samples;
+} pen_resample;
+
+// parses the output rate in Hz
+int pen_resample_parse(pen_resample *r, const char *arg);
+int pen_resample_push(pen_resample *r, const unsigned char *report,
+                      uint64_t t_ns);
+// fills out for the tick due at tick_ns, serviced late_ns after it; false
+// when there is nothing to send, and running is cleared once the pen has
+// left
+bool pen_resample_tick(pen_resample *r, uint64_t tick_ns, uint64_t late_ns,
+                       unsigned char *out);
+void pen_resample_print_stats(const pen_resample *r, FILE *out);
+
+#endif
@@ -0,0 +1,94 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+#include "pen_throttle.h"
+#include <stdlib.h>
+#include <string.h>
+
+// what a report has to change for the host to get it at once
+#define PEN_STATE_BITS                                                         \
+  (PEN_TIP | PEN_BARREL | PEN_ERASER | PEN_INVERT | PEN_SECONDARY_BARREL |     \
+   PEN_IN_RANGE)
+
+int pen_throttle_parse(pen_throttle *t, const char *arg) {
+  double hz, deadband = 0;
+  int n;
+
+  memset(t, 0, sizeof(*t));
+  n = sscanf(arg, "%lf,%lf", &hz, &deadband);
+  if (n < 1 || hz < 0 || hz > 10000 || deadband < 0 || deadband > PEN_MAX_X)
+    return -1;
+  t->enabled = true;
+  t->hover_period_ns = hz > 0 ? 1e9 / hz : 0;
+  t->deadband = deadband;
+  return 0;
+}
+
+static int32_t get_u16(const unsigned char *report, int offset) {
+  uint16_t v;
+
+  memcpy(&v, &report[offset], 2);
+  return v;
+}
+
+static bool pass(pen_throttle *t, const unsigned char *report,
+                 uint64_t t_ns) {
+  bool hover = (report[1] & (PEN_IN_RANGE | PEN_TIP)) == PEN_IN_RANGE;
+
+  if (!t->primed)
+    return true;
+  if (memcmp(report, t->last, W9013_REPORT_LEN) == 0) {
+    t->duplicates++;
+    return false;
+  }
+  if (!hover || (report[1] ^ t->last[1]) & PEN_STATE_BITS ||
+      memcmp(&report[PEN_X_TILT], &t->last[PEN_X_TILT], 4) != 0)
+    return true;
+  // without a dead-band, a report changing only the hover distance or the
+  // vendor byte is not one standing still
+  if (t->deadband &&
+      abs(get_u16(report, PEN_X) - get_u16(t->last, PEN_X)) <= t->deadband &&
+      abs(get_u16(report, PEN_Y) - get_u16(t->last, PEN_Y)) <= t->deadband) {
+    t->in_deadband++;
+    return false;
+  }
+  if (t_ns - t->last_ns < t->hover_period_ns) {
+    t->over_rate++;
+    return false;
+  }
+  return true;
+}
+
+bool pen_throttle_pass(pen_throttle *t, const unsigned char *report,
+                       uint64_t t_ns) {
+  bool hover = (report[1] & (PEN_IN_RANGE | PEN_TIP)) == PEN_IN_RANGE;
+
+  t->seen++;
+  t->hover_seen += hover;
+  if (!pass(t, report, t_ns))
+    return false;
+  t->hover_sent += hover;
+  memcpy(t->last, report, W9013_REPORT_LEN);
+  t->last_ns = t_ns;
+  t->primed = true;
+  return true;
+}
+
+void pen_throttle_print_stats(const pen_throttle *t, FILE *out) {
+  uint64_t dropped = t->duplicates + t->in_deadband + t->over_rate;
+
+  if (!t->enabled || !t->seen)
+    return;
+  fprintf(out,
+          "pen throttle: %llu of %llu reports dropped (%.1f%%), %llu "
+          "duplicates, %llu in the dead-band, %llu over the hover rate\n",
+          (unsigned long long)dropped, (unsigned long long)t->seen,
+          100.0 * dropped / t->seen, (unsigned long long)t->duplicates,
+          (unsigned long long)t->in_deadband,
+          (unsigned long long)t->over_rate);
+  if (t->hover_seen)
+    fprintf(out,
+            "pen throttle: hovering, %llu of %llu reports sent (%.1f%% "
+            "fewer)\n",
+            (unsigned long long)t->hover_sent,
+            (unsigned long long)t->hover_seen,
+            100.0 - 100.0 * t->hover_sent / t->hover_seen);
+}
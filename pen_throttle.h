@@ -0,0 +1,41 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+#ifndef PINENOTE_PEN_THROTTLE_H
+#define PINENOTE_PEN_THROTTLE_H
+
+#include "descriptors.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Thins out Report ID 2 while the pen only hovers. Every report is compared
+// with the last one sent: a byte-identical one is dropped, and while the
+// pen is in range with the tip up, so is one that moved no further than
+// the dead-band on X and Y, or that comes sooner than the hover rate
+// allows. A report whose tip, range or button bits or tilt changed always
+// goes out, so tip-down and button presses are never delayed.
+
+typedef struct {
+  bool enabled;
+  uint64_t hover_period_ns; // 0 for no rate cap
+  int32_t deadband;         // X/Y units, 0 for none
+
+  bool primed; // cleared when a report was sent around the throttle
+  unsigned char last[W9013_REPORT_LEN]; // last report sent
+  uint64_t last_ns;
+
+  uint64_t seen;
+  uint64_t duplicates;
+  uint64_t in_deadband;
+  uint64_t over_rate;
+  uint64_t hover_seen;
+  uint64_t hover_sent;
+} pen_throttle;
+
+// parses "<hover hz>[,<dead-band>]", 0 Hz only drops duplicates
+int pen_throttle_parse(pen_throttle *t, const char *arg);
+// false when the report is to be dropped, records it as sent otherwise
+bool pen_throttle_pass(pen_throttle *t, const unsigned char *report,
+                       uint64_t t_ns);
+void pen_throttle_print_stats(const pen_throttle *t, FILE *out);
+
+#endif
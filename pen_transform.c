@@ -0,0 +1,150 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+#include "pen_transform.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+void pen_transform_defaults(pen_transform *t) {
+  memset(t, 0, sizeof(*t));
+  t->area[2] = 1;
+  t->area[3] = 1;
+}
+
+int pen_transform_parse_rotation(pen_transform *t, const char *arg) {
+  char *end;
+  long degrees = strtol(arg, &end, 10);
+
+  if (*end || degrees < 0 || degrees > 270 || degrees % 90)
+    return -1;
+  t->rotation = degrees;
+  return 0;
+}
+
+int pen_transform_parse_area(pen_transform *t, const char *arg) {
+  double a[4];
+
+  if (sscanf(arg, "%lf,%lf,%lf,%lf", &a[0], &a[1], &a[2], &a[3]) != 4)
+    return -1;
+  if (a[0] < 0 || a[1] < 0 || a[2] <= 0 || a[3] <= 0 || a[0] + a[2] > 1 ||
+      a[1] + a[3] > 1)
+    return -1;
+  memcpy(t->area, a, sizeof(a));
+  return 0;
+}
+
+int pen_transform_parse_pressure(pen_transform *t, const char *arg) {
+  const char *p = arg;
+  int n = 0, used;
+
+  if (!strchr(arg, ':')) {
+    t->n_points = 0;
+    return sscanf(arg, "%lf", &t->gamma) == 1 && t->gamma > 0 ? 0 : -1;
+  }
+  while (*p) {
+    double in, out;
+
+    if (n == 16 || sscanf(p, "%lf:%lf%n", &in, &out, &used) != 2)
+      return -1;
+    if (in < 0 || in > 1 || out < 0 || out > 1 ||
+        (n && in <= t->points[n - 1][0]))
+      return -1;
+    t->points[n][0] = in;
+    t->points[n][1] = out;
+    n++;
+    p += used;
+    if (*p == ',')
+      p++;
+    else if (*p)
+      return -1;
+  }
+  t->n_points = n;
+  t->gamma = 0;
+  return n ? 0 : -1;
+}
+
+static double pressure_curve(const pen_transform *t, double in) {
+  int i;
+
+  if (t->gamma > 0)
+    return pow(in, t->gamma);
+  if (in <= t->points[0][0])
+    return t->points[0][1];
+  for (i = 1; i < t->n_points; i++) {
+    if (in <= t->points[i][0]) {
+      double f = (in - t->points[i - 1][0]) /
+                 (t->points[i][0] - t->points[i - 1][0]);
+      return t->points[i - 1][1] + f * (t->points[i][1] - t->points[i - 1][1]);
+    }
+  }
+  return t->points[t->n_points - 1][1];
+}
+
+void pen_transform_init(pen_transform *t) {
+  // rotation in coordinates normalized to 0..1:
+  // u' = r[0] * u + r[1] * v + r[2], v' = r[3] * u + r[4] * v + r[5]
+  static const int r[4][6] = {
+      {1, 0, 0, 0, 1, 0},   // 0
+      {0, -1, 1, 1, 0, 0},  // 90
+      {-1, 0, 1, 0, -1, 1}, // 180
+      {0, 1, 0, -1, 0, 1},  // 270
+  };
+  const int *m = r[t->rotation / 90];
+  double ax = t->area[0], ay = t->area[1], aw = t->area[2], ah = t->area[3];
+
+  t->xx = llround(65536.0 * aw * m[0]);
+  t->xy = llround(65536.0 * aw * m[1] * PEN_MAX_X / PEN_MAX_Y);
+  t->x0 = llround(65536.0 * PEN_MAX_X * (ax + aw * m[2])) + 32768;
+  t->yx = llround(65536.0 * ah * m[3] * PEN_MAX_Y / PEN_MAX_X);
+  t->yy = llround(65536.0 * ah * m[4]);
+  t->y0 = llround(65536.0 * PEN_MAX_Y * (ay + ah * m[5])) + 32768;
+
+  // tilt is a direction, it only turns with the rotation
+  t->txx = m[0];
+  t->txy = m[1];
+  t->tyx = m[3];
+  t->tyy = m[4];
+
+  t->map_pressure = t->gamma > 0 || t->n_points > 0;
+  for (int i = 0; i <= PEN_MAX_PRESSURE; i++) {
+    double out = t->map_pressure
+                     ? pressure_curve(t, (double)i / PEN_MAX_PRESSURE)
+                     : (double)i / PEN_MAX_PRESSURE;
+    t->pressure[i] = lround(out * PEN_MAX_PRESSURE);
+  }
+  // hovering must not turn into pressure
+  t->pressure[0] = 0;
+
+  t->enabled = t->rotation || ax != 0 || ay != 0 || aw != 1 || ah != 1 ||
+               t->map_pressure;
+}
+
+static inline int64_t clamp(int64_t v, int64_t min, int64_t max) {
+  return v < min ? min : v > max ? max : v;
+}
+
+void pen_transform_apply(const pen_transform *t, unsigned char *report) {
+  uint16_t x, y, pressure, out[3];
+  int16_t tx, ty, tilt[2];
+
+  if (report[0] != PEN_REPORT_ID)
+    return;
+  memcpy(&x, &report[PEN_X], 2);
+  memcpy(&y, &report[PEN_Y], 2);
+  memcpy(&pressure, &report[PEN_PRESSURE], 2);
+  memcpy(&tx, &report[PEN_X_TILT], 2);
+  memcpy(&ty, &report[PEN_Y_TILT], 2);
+
+  out[0] = clamp((t->xx * x + t->xy * y + t->x0) >> 16, 0, PEN_MAX_X);
+  out[1] = clamp((t->yx * x + t->yy * y + t->y0) >> 16, 0, PEN_MAX_Y);
+  out[2] = t->pressure[pressure > PEN_MAX_PRESSURE ? PEN_MAX_PRESSURE
+                                                   : pressure];
+  tilt[0] = t->txx * tx + t->txy * ty;
+  tilt[1] = t->tyx * tx + t->tyy * ty;
+
+  memcpy(&report[PEN_X], &out[0], 2);
+  memcpy(&report[PEN_Y], &out[1], 2);
+  memcpy(&report[PEN_PRESSURE], &out[2], 2);
+  memcpy(&report[PEN_X_TILT], &tilt[0], 2);
+  memcpy(&report[PEN_Y_TILT], &tilt[1], 2);
+}
@@ -0,0 +1,41 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+#ifndef PINENOTE_PEN_TRANSFORM_H
+#define PINENOTE_PEN_TRANSFORM_H
+
+#include "descriptors.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+// Rotation, area mapping and pressure curve for Report ID 2, rewritten in
+// place. The options only fill in the settings; pen_transform_init() folds
+// them into one affine map for X/Y, a sign/swap matrix for tilt and a
+// lookup table for pressure, so applying it is a few multiplies and a load.
+
+typedef struct {
+  // settings
+  int rotation;   // degrees clockwise, 0/90/180/270
+  double area[4]; // x, y, width, height as fractions of the logical range
+  int n_points;   // pressure curve control points, 0 for linear
+  double points[16][2];
+  double gamma; // used instead of points when > 0
+
+  // precomputed
+  bool enabled;
+  int64_t xx, xy, yx, yy; // Q16
+  int64_t x0, y0;         // Q16
+  int8_t txx, txy, tyx, tyy;
+  bool map_pressure;
+  uint16_t pressure[PEN_MAX_PRESSURE + 1];
+} pen_transform;
+
+void pen_transform_defaults(pen_transform *t);
+// parses 0, 90, 180 or 270
+int pen_transform_parse_rotation(pen_transform *t, const char *arg);
+// parses "<x>,<y>,<width>,<height>", each between 0 and 1
+int pen_transform_parse_area(pen_transform *t, const char *arg);
+// parses a gamma ("1.5") or up to 16 "<in>:<out>" points between 0 and 1
+int pen_transform_parse_pressure(pen_transform *t, const char *arg);
+void pen_transform_init(pen_transform *t);
+void pen_transform_apply(const pen_transform *t, unsigned char *report);
+
+#endif
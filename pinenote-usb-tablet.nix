@@ -17,5 +17,7 @@ stdenv.mkDerivation {
   installPhase = ''
     mkdir -p $out/bin
     cp pinenote-usb-tablet $out/bin/pinenote-usb-tablet
+    cp pinenote-virtual-input $out/bin/pinenote-virtual-input
+    cp pinenote-net-receiver $out/bin/pinenote-net-receiver
   '';
 }
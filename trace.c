@@ -0,0 +1,127 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+#include "trace.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+uint64_t monotonic_ns(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int trace_flush(trace_writer *w) {
+  size_t off = 0;
+
+  while (off < w->used) {
+    ssize_t n = write(w->fd, w->buf + off, w->used - off);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      perror("Failed to write trace");
+      return -1;
+    }
+    off += n;
+  }
+  w->used = 0;
+  return 0;
+}
+
+int trace_create(trace_writer *w, const char *path) {
+  trace_header h = {.magic = TRACE_MAGIC, .version = TRACE_VERSION};
+
+  w->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (w->fd < 0) {
+    fprintf(stderr, "Failed to create %s: %s\n", path, strerror(errno));
+    return -1;
+  }
+  memcpy(w->buf, &h, sizeof(h));
+  w->used = sizeof(h);
+  w->failed = false;
+  return 0;
+}
+
+int trace_write(trace_writer *w, uint8_t source, const void *data,
+                uint8_t len) {
+  size_t size = TRACE_RECORD_SIZE(len);
+  trace_record *rec;
+
+  if (w->failed)
+    return -1;
+  if (w->used + size > sizeof(w->buf) && trace_flush(w) < 0) {
+    fprintf(stderr, "Recording stopped\n");
+    w->failed = true;
+    return -1;
+  }
+  rec = (trace_record *)(w->buf + w->used);
+  memset(rec, 0, size);
+  rec->time_ns = monotonic_ns();
+  rec->source = source;
+  rec->len = len;
+  memcpy(rec->data, data, len);
+  w->used += size;
+  return 0;
+}
+
+int trace_close(trace_writer *w) {
+  int rc = w->failed ? -1 : trace_flush(w);
+
+  close(w->fd);
+  return rc;
+}
+
+int trace_map(trace_reader *r, const char *path) {
+  struct stat st;
+  const trace_header *h;
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+  if (fd < 0 || fstat(fd, &st) < 0) {
+    fprintf(stderr, "Failed to open %s: %s\n", path, strerror(errno));
+    if (fd >= 0)
+      close(fd);
+    return -1;
+  }
+  if ((size_t)st.st_size < sizeof(trace_header)) {
+    fprintf(stderr, "%s is not a trace\n", path);
+    close(fd);
+    return -1;
+  }
+  r->map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+  close(fd);
+  if (r->map == MAP_FAILED) {
+    fprintf(stderr, "Failed to map %s: %s\n", path, strerror(errno));
+    return -1;
+  }
+  r->size = st.st_size;
+  h = (const trace_header *)r->map;
+  if (memcmp(h->magic, TRACE_MAGIC, sizeof(h->magic)) != 0 ||
+      h->version != TRACE_VERSION) {
+    fprintf(stderr, "%s is not a version %d trace\n", path, TRACE_VERSION);
+    trace_unmap(r);
+    return -1;
+  }
+  r->off = sizeof(trace_header);
+  return 0;
+}
+
+const trace_record *trace_next(trace_reader *r) {
+  const trace_record *rec;
+
+  if (r->off + sizeof(trace_record) > r->size)
+    return NULL;
+  rec = (const trace_record *)(r->map + r->off);
+  if (r->off + TRACE_RECORD_SIZE(rec->len) > r->size)
+    return NULL;
+  r->off += TRACE_RECORD_SIZE(rec->len);
+  return rec;
+}
+
+void trace_unmap(trace_reader *r) {
+  munmap((void *)r->map, r->size);
+}
@@ -0,0 +1,68 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+#ifndef PINENOTE_TRACE_H
+#define PINENOTE_TRACE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// A trace is a header followed by records, each padded to 8 bytes so the
+// file can be walked in place once mapped:
+//   | time_ns | source | len | pad | data[len] | pad |
+// time_ns is CLOCK_MONOTONIC at the moment the forwarder read the data.
+// w9013 records hold a raw hidraw report, evdev records a trace_input_event.
+
+#define TRACE_MAGIC "PNTRACE1"
+#define TRACE_VERSION 1
+
+enum { TRACE_W9013, TRACE_WS8100_PEN, TRACE_CYTTSP5, N_TRACE_SOURCES };
+
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t reserved;
+} trace_header;
+
+typedef struct {
+  uint64_t time_ns;
+  uint8_t source;
+  uint8_t len;
+  uint8_t reserved[6];
+  unsigned char data[];
+} trace_record;
+
+typedef struct {
+  uint16_t type;
+  uint16_t code;
+  int32_t value;
+} trace_input_event;
+
+#define TRACE_RECORD_SIZE(len) ((sizeof(trace_record) + (len) + 7) & ~7UL)
+
+typedef struct {
+  int fd;
+  bool failed; // a write failed, nothing more is recorded
+  size_t used;
+  unsigned char buf[1 << 16];
+} trace_writer;
+
+typedef struct {
+  const unsigned char *map;
+  size_t size;
+  size_t off;
+} trace_reader;
+
+uint64_t monotonic_ns(void);
+
+int trace_create(trace_writer *w, const char *path);
+// the first failure is reported and stops the recording, -1 from then on
+int trace_write(trace_writer *w, uint8_t source, const void *data,
+                uint8_t len);
+int trace_close(trace_writer *w);
+
+int trace_map(trace_reader *r, const char *path);
+// returns NULL at the end of the trace or on a truncated record
+const trace_record *trace_next(trace_reader *r);
+void trace_unmap(trace_reader *r);
+
+#endif
@@ -0,0 +1,146 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+#include "uring.h"
+
+#ifdef HAVE_IO_URING
+
+#include <errno.h>
+#include <poll.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+int uring_init(uring *r, unsigned entries) {
+  struct io_uring_params p;
+  size_t sq_size, cq_size;
+  unsigned char *ring;
+
+  memset(r, 0, sizeof(*r));
+  memset(&p, 0, sizeof(p));
+  if ((r->fd = syscall(__NR_io_uring_setup, entries, &p)) < 0)
+    return -1;
+  // multishot polls have no feature flag, RSRC_TAGS came in the same
+  // release
+  if (!(p.features & IORING_FEAT_SINGLE_MMAP) ||
+      !(p.features & IORING_FEAT_RSRC_TAGS)) {
+    close(r->fd);
+    r->fd = -1;
+    errno = ENOSYS;
+    return -1;
+  }
+
+  // with IORING_FEAT_SINGLE_MMAP both rings share one mapping
+  sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  r->ring_size = sq_size > cq_size ? sq_size : cq_size;
+  r->ring = mmap(NULL, r->ring_size, PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+  r->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+  r->sqes = mmap(NULL, r->sqes_size, PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+  if (r->ring == MAP_FAILED || r->sqes == MAP_FAILED) {
+    if (r->ring != MAP_FAILED)
+      munmap(r->ring, r->ring_size);
+    if (r->sqes != MAP_FAILED)
+      munmap(r->sqes, r->sqes_size);
+    close(r->fd);
+    r->fd = -1;
+    return -1;
+  }
+
+  ring = r->ring;
+  r->sq_head = (unsigned *)(ring + p.sq_off.head);
+  r->sq_tail = (unsigned *)(ring + p.sq_off.tail);
+  r->sq_mask = (unsigned *)(ring + p.sq_off.ring_mask);
+  r->sq_array = (unsigned *)(ring + p.sq_off.array);
+  r->cq_head = (unsigned *)(ring + p.cq_off.head);
+  r->cq_tail = (unsigned *)(ring + p.cq_off.tail);
+  r->cq_mask = (unsigned *)(ring + p.cq_off.ring_mask);
+  r->cqes = (struct io_uring_cqe *)(ring + p.cq_off.cqes);
+  r->sq_entries = p.sq_entries;
+  // each slot of the submission queue always holds its own sqe
+  for (unsigned i = 0; i < p.sq_entries; i++)
+    r->sq_array[i] = i;
+  return 0;
+}
+
+void uring_free(uring *r) {
+  if (r->fd < 0)
+    return;
+  munmap(r->sqes, r->sqes_size);
+  munmap(r->ring, r->ring_size);
+  close(r->fd);
+  r->fd = -1;
+}
+
+static struct io_uring_sqe *next_sqe(uring *r) {
+  unsigned head = atomic_load_explicit((_Atomic unsigned *)r->sq_head,
+                                       memory_order_acquire);
+  unsigned tail = *r->sq_tail + r->queued;
+  struct io_uring_sqe *sqe;
+
+  if (tail - head >= r->sq_entries)
+    return NULL;
+  sqe = &r->sqes[tail & *r->sq_mask];
+  memset(sqe, 0, sizeof(*sqe));
+  r->queued++;
+  return sqe;
+}
+
+int uring_prep_poll(uring *r, int fd, uint64_t user_data) {
+  struct io_uring_sqe *sqe = next_sqe(r);
+
+  if (!sqe)
+    return -1;
+  sqe->opcode = IORING_OP_POLL_ADD;
+  sqe->fd = fd;
+  sqe->poll32_events = POLLIN;
+  sqe->len = IORING_POLL_ADD_MULTI;
+  sqe->user_data = user_data;
+  return 0;
+}
+
+int uring_prep_poll_remove(uring *r, uint64_t target, uint64_t user_data) {
+  struct io_uring_sqe *sqe = next_sqe(r);
+
+  if (!sqe)
+    return -1;
+  sqe->opcode = IORING_OP_POLL_REMOVE;
+  sqe->fd = -1;
+  sqe->addr = target;
+  sqe->user_data = user_data;
+  return 0;
+}
+
+int uring_submit_and_wait(uring *r) {
+  unsigned tail = *r->sq_tail + r->queued;
+  int rc;
+
+  atomic_store_explicit((_Atomic unsigned *)r->sq_tail, tail,
+                        memory_order_release);
+  r->queued = 0;
+  r->enters++;
+  // everything the kernel has not consumed yet, a call interrupted by a
+  // signal may have left some behind
+  rc = syscall(__NR_io_uring_enter, r->fd,
+               tail - atomic_load_explicit((_Atomic unsigned *)r->sq_head,
+                                           memory_order_acquire),
+               1, IORING_ENTER_GETEVENTS, NULL, 0);
+  return rc < 0 ? -1 : 0;
+}
+
+struct io_uring_cqe *uring_peek(uring *r) {
+  unsigned head = *r->cq_head;
+  unsigned tail = atomic_load_explicit((_Atomic unsigned *)r->cq_tail,
+                                       memory_order_acquire);
+
+  return head == tail ? NULL : &r->cqes[head & *r->cq_mask];
+}
+
+void uring_seen(uring *r) {
+  atomic_store_explicit((_Atomic unsigned *)r->cq_head, *r->cq_head + 1,
+                        memory_order_release);
+}
+
+#endif
@@ -0,0 +1,54 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+#ifndef PINENOTE_URING_H
+#define PINENOTE_URING_H
+
+#ifdef HAVE_IO_URING
+
+#include <linux/io_uring.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// The few io_uring calls the --io-engine uring loop needs, on the raw
+// syscalls so there is no library to depend on. One ring, used from one
+// thread: requests are queued with the prep functions and all go to the
+// kernel in the same io_uring_enter() that waits for the next completion.
+//
+// Only polls are used. hidraw and evdev have no non-blocking read path
+// for io_uring, a read submitted on them goes to a kernel worker thread;
+// a poll is answered in the context that made the device readable.
+
+typedef struct {
+  int fd;
+  void *ring;
+  size_t ring_size;
+  struct io_uring_sqe *sqes;
+  size_t sqes_size;
+  unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+  unsigned *cq_head, *cq_tail, *cq_mask;
+  struct io_uring_cqe *cqes;
+  unsigned sq_entries;
+  unsigned queued; // prepared since the last submit
+  uint64_t enters;
+} uring;
+
+// fails with ENOSYS on kernels without io_uring, or older than 5.13, which
+// added multishot polls
+int uring_init(uring *r, unsigned entries);
+void uring_free(uring *r);
+// the prep functions return -1 when the submission queue is full
+
+// a multishot POLLIN: one completion each time fd becomes readable, until
+// one comes without IORING_CQE_F_MORE
+int uring_prep_poll(uring *r, int fd, uint64_t user_data);
+// cancels the poll submitted with target, whose last completion then has
+// -ECANCELED
+int uring_prep_poll_remove(uring *r, uint64_t target, uint64_t user_data);
+// submits what was prepared and waits for at least one completion
+int uring_submit_and_wait(uring *r);
+// the oldest completion not yet seen, NULL if there is none
+struct io_uring_cqe *uring_peek(uring *r);
+void uring_seen(uring *r);
+
+#endif
+
+#endif
@@ -0,0 +1,411 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+// Creates uhid/uinput stand-ins for the w9013, ws8100_pen and cyttsp5 with the
+// names and ids pinenote-usb-tablet looks for, so the whole forwarding path
+// can run on a machine without PineNote hardware.
+#include "descriptors.h"
+#include "libevdev-1.0/libevdev/libevdev-uinput.h"
+#include "libevdev-1.0/libevdev/libevdev.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/uhid.h>
+#include <math.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#define TOUCH_MAX_X 1862
+#define TOUCH_MAX_Y 1398
+
+typedef struct {
+  int w9013_fd; // uhid
+  struct libevdev_uinput *w9013;
+  struct libevdev_uinput *ws8100_pen;
+  struct libevdev_uinput *cyttsp5;
+} virtual_devices;
+
+// what was generated, for comparing against the forwarder's --stats
+typedef struct {
+  uint64_t pen_reports;
+  uint64_t touch_frames;
+  uint64_t touch_downs;
+  uint64_t late_ticks; // timer expirations that had to be caught up on
+} load_stats;
+
+int create_w9013_hidraw(void) {
+  struct uhid_event ev = {.type = UHID_CREATE2};
+  int fd = open("/dev/uhid", O_RDWR | O_NONBLOCK | O_CLOEXEC);
+
+  if (fd < 0) {
+    perror("Failed to open /dev/uhid");
+    return -1;
+  }
+  snprintf((char *)ev.u.create2.name, sizeof(ev.u.create2.name),
+           "w9013 2D1F:0095");
+  ev.u.create2.rd_size = report_desc_w9013_len;
+  ev.u.create2.bus = BUS_I2C;
+  ev.u.create2.vendor = W9013_VENDOR;
+  ev.u.create2.product = W9013_PRODUCT;
+  memcpy(ev.u.create2.rd_data, report_desc_w9013, report_desc_w9013_len);
+  if (write(fd, &ev, sizeof(ev)) != sizeof(ev)) {
+    perror("Failed to create w9013 uhid device");
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+int create_uinput(struct libevdev *dev, struct libevdev_uinput **out) {
+  int rc = libevdev_uinput_create_from_device(
+      dev, LIBEVDEV_UINPUT_OPEN_MANAGED, out);
+
+  if (rc < 0)
+    fprintf(stderr, "Failed to create %s: %s\n", libevdev_get_name(dev),
+            strerror(-rc));
+  else
+    printf("Created %s at: %s\n", libevdev_get_name(dev),
+           libevdev_uinput_get_devnode(*out));
+  libevdev_free(dev);
+  return rc;
+}
+
+int create_devices(virtual_devices *v) {
+  struct libevdev *dev;
+  struct input_absinfo abs = {0};
+  unsigned int ws8100_keys[] = {BTN_TOOL_RUBBER, KEY_MACRO1, BTN_TOOL_PEN,
+                                KEY_MACRO2,      BTN_STYLUS3, KEY_SLEEP,
+                                KEY_MACRO3};
+
+  if ((v->w9013_fd = create_w9013_hidraw()) < 0)
+    return -1;
+
+  // the forwarder only grabs this one to keep the pen away from the local
+  // input stack, reports are read from the hidraw node above
+  dev = libevdev_new();
+  libevdev_set_name(dev, W9013_NAME);
+  libevdev_set_id_bustype(dev, BUS_I2C);
+  libevdev_set_id_vendor(dev, W9013_VENDOR);
+  libevdev_set_id_product(dev, W9013_PRODUCT);
+  libevdev_enable_event_code(dev, EV_KEY, BTN_TOOL_PEN, NULL);
+  libevdev_enable_event_code(dev, EV_KEY, BTN_TOUCH, NULL);
+  abs.maximum = PEN_MAX_X;
+  libevdev_enable_event_code(dev, EV_ABS, ABS_X, &abs);
+  abs.maximum = PEN_MAX_Y;
+  libevdev_enable_event_code(dev, EV_ABS, ABS_Y, &abs);
+  if (create_uinput(dev, &v->w9013) < 0)
+    return -1;
+
+  dev = libevdev_new();
+  libevdev_set_name(dev, WS8100_PEN_NAME);
+  libevdev_set_id_bustype(dev, BUS_BLUETOOTH);
+  for (size_t i = 0; i < sizeof(ws8100_keys) / sizeof(ws8100_keys[0]); i++)
+    libevdev_enable_event_code(dev, EV_KEY, ws8100_keys[i], NULL);
+  if (create_uinput(dev, &v->ws8100_pen) < 0)
+    return -1;
+
+  dev = libevdev_new();
+  libevdev_set_name(dev, CYTTSP5_NAME);
+  libevdev_set_id_bustype(dev, BUS_I2C);
+  libevdev_enable_property(dev, INPUT_PROP_DIRECT);
+  abs.maximum = MAX_SLOTS - 1;
+  libevdev_enable_event_code(dev, EV_ABS, ABS_MT_SLOT, &abs);
+  abs.maximum = 65535;
+  libevdev_enable_event_code(dev, EV_ABS, ABS_MT_TRACKING_ID, &abs);
+  abs.maximum = TOUCH_MAX_X;
+  libevdev_enable_event_code(dev, EV_ABS, ABS_MT_POSITION_X, &abs);
+  abs.maximum = TOUCH_MAX_Y;
+  libevdev_enable_event_code(dev, EV_ABS, ABS_MT_POSITION_Y, &abs);
+  if (create_uinput(dev, &v->cyttsp5) < 0)
+    return -1;
+
+  return 0;
+}
+
+void destroy_devices(virtual_devices *v) {
+  if (v->cyttsp5)
+    libevdev_uinput_destroy(v->cyttsp5);
+  if (v->ws8100_pen)
+    libevdev_uinput_destroy(v->ws8100_pen);
+  if (v->w9013)
+    libevdev_uinput_destroy(v->w9013);
+  if (v->w9013_fd >= 0)
+    close(v->w9013_fd); // destroys the uhid device
+}
+
+int send_pen_report(int fd, const unsigned char *report) {
+  struct uhid_event ev = {.type = UHID_INPUT2};
+  size_t size = offsetof(struct uhid_event, u.input2.data) + W9013_REPORT_LEN;
+
+  ev.u.input2.size = W9013_REPORT_LEN;
+  memcpy(ev.u.input2.data, report, W9013_REPORT_LEN);
+  if (write(fd, &ev, size) != (ssize_t)size) {
+    perror("Failed to send pen report");
+    return -1;
+  }
+  return 0;
+}
+
+// pen held down and drawing a circle
+int pen_tick(virtual_devices *v, uint64_t n) {
+  unsigned char report[W9013_REPORT_LEN] = {PEN_REPORT_ID,
+                                            PEN_IN_RANGE | PEN_TIP};
+  double a = n * 0.01;
+  uint16_t x = PEN_MAX_X / 2 + cos(a) * PEN_MAX_X / 4;
+  uint16_t y = PEN_MAX_Y / 2 + sin(a) * PEN_MAX_Y / 4;
+  uint16_t pressure = 2048 + sin(a * 3) * 1024;
+
+  memcpy(&report[PEN_X], &x, 2);
+  memcpy(&report[PEN_Y], &y, 2);
+  memcpy(&report[PEN_PRESSURE], &pressure, 2);
+  return send_pen_report(v->w9013_fd, report);
+}
+
+// every slot in use, one contact lifting and a new one landing each frame
+int storm_tick(virtual_devices *v, uint64_t n, load_stats *st) {
+  int lift = n % MAX_SLOTS, land = (n + MAX_SLOTS - 1) % MAX_SLOTS;
+  int x = n % TOUCH_MAX_X;
+
+  for (int i = 0; i < MAX_SLOTS; i++) {
+    libevdev_uinput_write_event(v->cyttsp5, EV_ABS, ABS_MT_SLOT, i);
+    if (n > 0 && i == lift) {
+      libevdev_uinput_write_event(v->cyttsp5, EV_ABS, ABS_MT_TRACKING_ID, -1);
+      continue;
+    }
+    // the slot lifted on the previous frame gets a new contact
+    if (n == 0 || (n > 1 && i == land)) {
+      libevdev_uinput_write_event(v->cyttsp5, EV_ABS, ABS_MT_TRACKING_ID,
+                                  (n ? MAX_SLOTS + n : i) & 0xffff);
+      st->touch_downs++;
+    }
+    libevdev_uinput_write_event(v->cyttsp5, EV_ABS, ABS_MT_POSITION_X,
+                                (x + i * 97) % TOUCH_MAX_X);
+    libevdev_uinput_write_event(v->cyttsp5, EV_ABS, ABS_MT_POSITION_Y,
+                                (i + 1) * TOUCH_MAX_Y / (MAX_SLOTS + 1));
+  }
+  return libevdev_uinput_write_event(v->cyttsp5, EV_SYN, SYN_REPORT, 0);
+}
+
+// fingers dragged side by side across the screen
+int touch_tick(virtual_devices *v, uint64_t n, int fingers) {
+  int x = n % TOUCH_MAX_X;
+
+  for (int i = 0; i < fingers; i++) {
+    libevdev_uinput_write_event(v->cyttsp5, EV_ABS, ABS_MT_SLOT, i);
+    if (n == 0)
+      libevdev_uinput_write_event(v->cyttsp5, EV_ABS, ABS_MT_TRACKING_ID, i);
+    libevdev_uinput_write_event(v->cyttsp5, EV_ABS, ABS_MT_POSITION_X, x);
+    libevdev_uinput_write_event(v->cyttsp5, EV_ABS, ABS_MT_POSITION_Y,
+                                (i + 1) * TOUCH_MAX_Y / (fingers + 1));
+  }
+  return libevdev_uinput_write_event(v->cyttsp5, EV_SYN, SYN_REPORT, 0);
+}
+
+// answers feature report requests the hid core sends to the uhid device
+void drain_uhid(int fd) {
+  struct uhid_event ev, reply = {0};
+
+  while (read(fd, &ev, sizeof(ev)) > 0) {
+    if (ev.type != UHID_GET_REPORT)
+      continue;
+    reply.type = UHID_GET_REPORT_REPLY;
+    reply.u.get_report_reply.id = ev.u.get_report.id;
+    reply.u.get_report_reply.err = EIO;
+    write(fd, &reply, sizeof(reply));
+  }
+}
+
+int start_timer(int epfd, long rate) {
+  struct itimerspec its = {0};
+  struct epoll_event ev = {.events = EPOLLIN};
+  long long period_ns;
+  int fd;
+
+  if (rate <= 0)
+    return -1;
+  fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  period_ns = 1000000000LL / rate;
+  its.it_interval.tv_sec = period_ns / 1000000000;
+  its.it_interval.tv_nsec = period_ns % 1000000000;
+  // an all-zero it_value would disarm the timer, at 1 Hz as well
+  its.it_value = its.it_interval;
+  timerfd_settime(fd, 0, &its, NULL);
+  ev.data.fd = fd;
+  epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+  return fd;
+}
+
+void arm_once(int fd, double secs) {
+  struct itimerspec its = {0};
+
+  its.it_value.tv_sec = secs;
+  its.it_value.tv_nsec = (secs - its.it_value.tv_sec) * 1e9;
+  timerfd_settime(fd, 0, &its, NULL);
+}
+
+void print_load_stats(const load_stats *st, double secs) {
+  fprintf(stderr, "sent %llu pen reports (%.0f/s), %llu touch frames "
+                  "(%.0f/s, %llu contacts landed), %llu late ticks\n",
+          (unsigned long long)st->pen_reports,
+          secs > 0 ? st->pen_reports / secs : 0.0,
+          (unsigned long long)st->touch_frames,
+          secs > 0 ? st->touch_frames / secs : 0.0,
+          (unsigned long long)st->touch_downs,
+          (unsigned long long)st->late_ticks);
+}
+
+int main(int argc, char *argv[]) {
+  virtual_devices v = {.w9013_fd = -1};
+  long pen_rate = 0, touch_rate = 0;
+  int fingers = 2, epfd, sigfd, pen_timer = -1, touch_timer = -1;
+  int phase_timer = -1, rc = 0;
+  uint64_t pen_n = 0, touch_n = 0, expirations;
+  double delay = 0, duration = 0;
+  bool storm = false, show_stats = false, started = false, sending = false;
+  load_stats st = {0};
+  struct timespec start = {0}, end = {0};
+  struct epoll_event ev = {.events = EPOLLIN};
+  sigset_t mask;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--pen-rate") == 0 && i + 1 < argc) {
+      pen_rate = strtol(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--touch-rate") == 0 && i + 1 < argc) {
+      touch_rate = strtol(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--fingers") == 0 && i + 1 < argc &&
+               (fingers = strtol(argv[i + 1], NULL, 10)) >= 1 &&
+               fingers <= MAX_SLOTS) {
+      i++;
+    } else if (strcmp(argv[i], "--storm") == 0) {
+      storm = true;
+    } else if (strcmp(argv[i], "--delay") == 0 && i + 1 < argc) {
+      delay = strtod(argv[++i], NULL);
+    } else if (strcmp(argv[i], "--duration") == 0 && i + 1 < argc) {
+      duration = strtod(argv[++i], NULL);
+    } else if (strcmp(argv[i], "--stats") == 0) {
+      show_stats = true;
+    } else {
+      printf("creates virtual w9013, ws8100_pen and cyttsp5 devices.\n");
+      printf("Usage: %s [options]\n\n", argv[0]);
+      printf("Options:\n"
+             "  --pen-rate <hz>     draw a circle with the pen\n"
+             "  --touch-rate <hz>   drag fingers across the touchscreen\n"
+             "  --fingers <n>       number of fingers to drag, 1 to 10 "
+             "(default 2)\n"
+             "  --storm             use every touch slot, lifting and "
+             "landing a\n"
+             "                      contact each frame\n"
+             "  --delay <s>         create the devices, then wait this long "
+             "before\n"
+             "                      sending\n"
+             "  --duration <s>      stop sending after this many seconds, "
+             "the\n"
+             "                      devices stay until interrupted\n"
+             "  --stats             print what was sent on exit\n");
+      return -1;
+    }
+  }
+
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGINT);
+  sigaddset(&mask, SIGTERM);
+  sigprocmask(SIG_BLOCK, &mask, NULL);
+  sigfd = signalfd(-1, &mask, SFD_CLOEXEC);
+  epfd = epoll_create1(EPOLL_CLOEXEC);
+
+  if (create_devices(&v) < 0) {
+    rc = -1;
+    goto cleanup;
+  }
+
+  ev.data.fd = sigfd;
+  epoll_ctl(epfd, EPOLL_CTL_ADD, sigfd, &ev);
+  ev.data.fd = v.w9013_fd;
+  epoll_ctl(epfd, EPOLL_CTL_ADD, v.w9013_fd, &ev);
+  // --delay gives the forwarder time to open the devices and --duration
+  // leaves it time to drain them, so a load run can count every report
+  if (delay > 0 || duration > 0) {
+    phase_timer = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    ev.data.fd = phase_timer;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, phase_timer, &ev);
+    arm_once(phase_timer, delay > 0 ? delay : duration);
+  }
+  if (delay <= 0) {
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    pen_timer = start_timer(epfd, pen_rate);
+    touch_timer = start_timer(epfd, touch_rate);
+    started = sending = true;
+  }
+
+  for (;;) {
+    struct epoll_event events[4];
+    int n = epoll_wait(epfd, events, 4, -1);
+
+    if (n < 0 && errno != EINTR)
+      break;
+    for (int i = 0; i < n; i++) {
+      int fd = events[i].data.fd;
+
+      if (fd == sigfd)
+        goto cleanup;
+      if (fd == v.w9013_fd) {
+        drain_uhid(fd);
+        continue;
+      }
+      if (read(fd, &expirations, sizeof(expirations)) != sizeof(expirations))
+        continue;
+      if (fd == phase_timer && !started) {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        pen_timer = start_timer(epfd, pen_rate);
+        touch_timer = start_timer(epfd, touch_rate);
+        started = sending = true;
+        if (duration > 0)
+          arm_once(phase_timer, duration);
+        continue;
+      }
+      if (fd == phase_timer) {
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        if (pen_timer >= 0)
+          close(pen_timer);
+        if (touch_timer >= 0)
+          close(touch_timer);
+        pen_timer = touch_timer = -1;
+        sending = false;
+        continue;
+      }
+      // at high rates a wakeup can come late, catch up on the ticks it
+      // missed so the offered load stays what was asked for
+      if (expirations > 1)
+        st.late_ticks += expirations - 1;
+      for (uint64_t e = 0; e < expirations; e++) {
+        if (fd == pen_timer) {
+          if (pen_tick(&v, pen_n++) < 0)
+            goto cleanup;
+          st.pen_reports++;
+        } else if (fd == touch_timer) {
+          if (storm)
+            storm_tick(&v, touch_n++, &st);
+          else
+            touch_tick(&v, touch_n++, fingers);
+          st.touch_frames++;
+        }
+      }
+    }
+  }
+
+cleanup:
+  if (sending)
+    clock_gettime(CLOCK_MONOTONIC, &end);
+  if (show_stats)
+    print_load_stats(&st, (end.tv_sec - start.tv_sec) +
+                              (end.tv_nsec - start.tv_nsec) / 1e9);
+  destroy_devices(&v);
+  return rc;
+}